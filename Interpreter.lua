@@ -62,9 +62,13 @@ ffi.cdef[[
     void St_stop();
     void St_start();
     void St_log( const char* msg );
+    int St_saveImage();
     const char* St_toString( ByteArray* ba );
     int St_extractBitsSi(int from, int to, int word);
-    int St_pendingEvents();
+    typedef struct { int word; int input; } EventFlags;
+    EventFlags* St_eventFlags();
+    void St_pollEvents();
+    uint32_t St_ticks();
     void St_beDisplay( WordArray* wa, int width, int height );
     void St_beCursor( WordArray* wa, int width, int height );
     void St_bitBlt( WordArray* destBits, int destW, int destH,
@@ -88,10 +92,14 @@ ffi.cdef[[
     int St_seekFile( int fd, int pos );
     int St_readFile( int fd, ByteArray* ba );
     int St_writeFile( int fd, ByteArray* ba, int toWrite );
+    int St_readFileAt( int fd, int pos, ByteArray* ba );
+    int St_writeFileAt( int fd, int pos, ByteArray* ba, int toWrite );
     int St_truncateFile( int fd, int size );
     int St_createFile( ByteArray* ba );
     int St_deleteFile( ByteArray* ba );
     int St_renameFile( ByteArray* from, ByteArray* to );
+    typedef struct { int samples; int interpreted; } ProfileProbe;
+    ProfileProbe* St_profileProbe();
 ]]
 
 ------------------ Module Data ------------------------------------------
@@ -115,6 +123,35 @@ local primitive = {}
 local success = true
 local cycleNr = 0
 local toSignal
+-- written by StLjLibFfi.cpp, checked on sends and backward jumps; the C side is only polled every
+-- PollInterval checks, see checkEvents
+local eventFlags
+local pollCountdown = 1
+local PollInterval = 256
+-- Method cache, deviation from BB: class -> { selector -> method } and method -> primitive index.
+-- Lua objects have no address to hash without a C call, so the two level table replaces the
+-- hashed methodCache array; the lookups are plain table reads the tracing JIT compiles inline.
+-- Tables are only created on a miss and on flush; see flushMethodCache.
+local methodCache = {}
+local primitiveCache = {}
+-- Optional translation tier, see Translator.lua; enabled by the global TranslateMethods.
+-- Methods activated or looped in HotThreshold times are translated to Lua functions, which the
+-- cycle calls when the instruction pointer is at one of their entries; method -> { fn, entries }.
+local translator
+local translated = {}
+local hotness = {}
+local HotThreshold = 500
+-- Smalltalk method attribution of the LuaJIT profiler samples, enabled by the global ProfileMethods;
+-- the profiler callback counts samples in the probe, which the cycle charges to the active method.
+local profiler
+-- Trace start, stop and abort events of the JIT, enabled by the global JitLog; aborts are counted by
+-- reason, Interpreter.lua function and Smalltalk method.
+local jitlog
+local methodNames = {} -- method -> "Class>>selector", see methodNameOf
+-- Evaluation of the expression in the global RunScript for headless runs, see runScript
+local runner
+local runCheck = -1 -- cycle at which runScript is called next; -1 if there is no script
+local RunWarmup = 100000 -- cycles for the image to settle before the script is started
 
 ------------------ Cached Objects ------------------------------------------
 local bitand
@@ -532,6 +569,22 @@ local function newActiveContext(aContext)
     fetchContextRegisters()
 end
 
+local function noteHot(m)
+	local n = ( hotness[m] or 0 ) + 1
+	hotness[m] = n
+	if n == HotThreshold then
+		local fn, entries = translator.translate(m)
+		if fn then
+			translated[m] = { fn = fn, entries = entries }
+		end
+	end
+end
+
+local function flushTranslations()
+	translated = {}
+	hotness = {}
+end
+
 local function executeNewMethod()
     -- ST_TRACE_METHOD_CALL()
     if not primitiveResponse() then
@@ -555,13 +608,77 @@ local function executeNewMethod()
 		pop( argumentCount + 1 )
 		newActiveContext(newContext)
 		--end
+		if translator then
+			noteHot(newMethod)
+		end
         
     end
 end
 
+local function flushMethodCache()
+	methodCache = {}
+	primitiveCache = {}
+end
+
+local function findNewMethodInClass(cls) -- called three times
+	local perClass = methodCache[cls]
+	local cached = perClass and perClass[messageSelector]
+	if cached then
+		newMethod = cached
+		primitiveIndex = primitiveCache[cached]
+		return
+	end
+	local selector = messageSelector
+	-- a doesNotUnderstand: lookup changes messageSelector and the stack, so it is not cached
+	if lookupMethodInClass(cls) and selector == messageSelector then
+		if perClass == nil then
+			perClass = {}
+			methodCache[cls] = perClass
+		end
+		perClass[selector] = newMethod
+		primitiveCache[newMethod] = primitiveIndex
+	end
+end
+
+local function drainEvents()
+	local word = eventFlags.word
+	eventFlags.word = bitand( word, 8 ) -- Stopped stays set
+	if bitand( word, 1 ) ~= 0 then -- InputPending
+		local pending = eventFlags.input
+		eventFlags.input = 0
+		if inputSemaphore then
+			for i=1,pending do
+				-- asynchronousSignal(inputSemaphore) inlined
+				semaphoreIndex = semaphoreIndex + 1
+				semaphoreList[semaphoreIndex] = inputSemaphore
+			end
+		end
+	end
+	if bitand( word, 2 ) ~= 0 then -- TimerDue
+		-- asynchronousSignal(toSignal) inlined
+		semaphoreIndex = semaphoreIndex + 1
+		semaphoreList[semaphoreIndex] = toSignal
+	end
+	if bitand( word, 4 ) ~= 0 then -- CopyRequested
+		local str = memory.knownObjects.CurrentSelection[1][0]
+		C.St_copyToClipboard(str.data)
+	end
+end
+
+local function checkEvents()
+	pollCountdown = pollCountdown - 1
+	if pollCountdown == 0 then
+		pollCountdown = PollInterval
+		C.St_pollEvents()
+	end
+	if eventFlags.word ~= 0 then
+		drainEvents()
+	end
+end
+
 local function sendSelectorToClass(classPointer) -- called three times
-    -- deviation from BB, we currently don't have a methodCache, original: findNewMethodInClass
-    lookupMethodInClass(classPointer)
+	checkEvents()
+    findNewMethodInClass(classPointer)
     executeNewMethod()
 end
 
@@ -798,6 +915,12 @@ local function jumpBytecode()
 		offset = ( offset - 4 ) * 256 + fetchByte()
 		-- ST_TRACE_BYTECODE("offset:", offset )
 		jump( offset )
+		if offset < 0 then
+			checkEvents()
+			if translator then
+				noteHot(method)
+			end
+		end
     elseif b >= 168 and b <= 175 then
         -- longConditionalJump()
 		local offset = C.St_extractBits( 14, 15, currentBytecode )
@@ -922,43 +1045,299 @@ local function checkProcessSwitch()
     end
 end
 
-local function cycle()
-	local pending = C.St_pendingEvents()
-	if pending > 0 then
-		for i=1,pending do
-			-- asynchronousSignal(inputSemaphore) inlined
-			if inputSemaphore then
-				semaphoreIndex = semaphoreIndex + 1
-				semaphoreList[semaphoreIndex] = inputSemaphore
+local function methodNameOf( m, cls )
+	local knowns = memory.knownObjects
+	while cls ~= nil do
+		local dictionary = cls[1] -- MessageDictionaryIndex
+		local methodArray = dictionary[1] -- MethodArrayIndex
+		for i = 2, dictionary.count - 1 do -- SelectorStart
+			if methodArray[i-2] == m then
+				local name = cls[6]
+				local suffix = ""
+				if fetchClassOf(name) ~= knowns[0x38] then -- a metaclass refers to its sole instance
+					name = name[6]
+					suffix = " class"
+				end
+				return ffi.string(C.St_toString( name.data )) .. suffix .. ">>" ..
+					ffi.string(C.St_toString( dictionary[i].data ))
 			end
 		end
-	elseif pending == -1 then
-		-- asynchronousSignal(toSignal) inlined
-		semaphoreIndex = semaphoreIndex + 1
-		semaphoreList[semaphoreIndex] = toSignal
-	elseif pending == -2 then
-		local str = memory.knownObjects.CurrentSelection[1][0]
-		C.St_copyToClipboard(str.data)
+		cls = superclassOf(cls)
+	end
+	return "method " .. tostring(m.oop)
+end
+
+local function profileNameOf( ctx )
+	local home = ctx
+	if isBlockContext(ctx) then
+		home = ctx[5] -- HomeIndex
+	end
+	local m = home[3] -- MethodIndex
+	local name = methodNames[m]
+	if name == nil then
+		name = methodNameOf( m, fetchClassOf( home[5] ) ) -- ReceiverIndex
+		methodNames[m] = name
+	end
+	return name
+end
+
+local function sampleMethod()
+	local probe = profiler.probe
+	local samples = probe.samples
+	local interpreted = probe.interpreted
+	probe.samples = 0
+	probe.interpreted = 0
+	
+	local name = profileNameOf( activeContext )
+	profiler.self[name] = ( profiler.self[name] or 0 ) + samples
+	profiler.interpreted[name] = ( profiler.interpreted[name] or 0 ) + interpreted
+	
+	local frames = {}
+	local ctx = activeContext
+	while ctx ~= nil and #frames < 100 do
+		table.insert( frames, 1, profileNameOf( ctx ) )
+		ctx = ctx[0] -- SenderIndex or CallerIndex
+	end
+	local stack = table.concat( frames, ";" )
+	profiler.stacks[stack] = ( profiler.stacks[stack] or 0 ) + samples
+end
+
+local function reportProfile()
+	local names = {}
+	local total = 0
+	for name, n in pairs(profiler.self) do
+		names[#names+1] = name
+		total = total + n
+	end
+	if total == 0 then
+		return
+	end
+	table.sort( names, function(a,b) return profiler.self[a] > profiler.self[b] end )
+	print( "profile of " .. total .. " samples; self % and % thereof in the LuaJIT interpreter" )
+	for i = 1, math.min( #names, 50 ) do
+		local n = profiler.self[names[i]]
+		print( string.format( "%6.1f%% %6.1f%%  %s", n / total * 100, profiler.interpreted[names[i]] / n * 100, names[i] ) )
 	end
+	local out = io.open( "profile.folded", "w" )
+	if out then
+		for stack, n in pairs(profiler.stacks) do
+			out:write( stack, " ", n, "\n" )
+		end
+		out:close()
+		print "collapsed stacks written to profile.folded"
+	end
+end
+
+-- maps the line where each function of Interpreter.lua is defined to its name
+local function functionLines()
+	local lines = {}
+	local source = loadresource and loadresource( "Interpreter.lua" )
+	if source == nil then
+		return lines
+	end
+	local nr = 0
+	for line in string.gmatch( source, "([^\n]*)\n" ) do
+		nr = nr + 1
+		local name = string.match( line, "^%s*local%s+function%s+([%w_%.:]+)" ) or 
+			string.match( line, "^%s*function%s+([%w_%.:]+)" )
+		if name then
+			lines[nr] = name
+		end
+	end
+	return lines
+end
+
+local function jitEvent( what, tr, func, pc, otr, oex )
+	if what == "start" then
+		jitlog.started = jitlog.started + 1
+	elseif what == "stop" then
+		jitlog.stopped = jitlog.stopped + 1
+	elseif what == "abort" then
+		local reason = jitlog.reasons and jitlog.reasons[otr]
+		if reason == nil then
+			reason = "error " .. tostring(otr)
+		elseif string.find( reason, "%%" ) then
+			if type(oex) == "number" and string.find( reason, "%%d" ) then
+				reason = string.format( reason, oex )
+			else
+				reason = string.format( reason, tostring(oex) )
+			end
+		end
+		local info = jitlog.util.funcinfo( func, pc )
+		local where = jitlog.lines[info.linedefined]
+		if where == nil or not string.find( tostring(info.source), "Interpreter" ) then
+			where = tostring(info.source) .. ":" .. tostring(info.linedefined)
+		end
+		where = where .. ":" .. tostring(info.currentline)
+		local st = "?"
+		if activeContext then
+			st = profileNameOf( activeContext )
+		end
+		local key = reason .. "\t" .. where .. "\t" .. st
+		jitlog.aborts[key] = ( jitlog.aborts[key] or 0 ) + 1
+		jitlog.aborted = jitlog.aborted + 1
+	end
+end
+
+local function startJitLog()
+	local ok, vmdef = pcall( require, "jit.vmdef" )
+	jitlog = { started = 0, stopped = 0, aborted = 0, aborts = {}, lines = functionLines(), 
+		util = require "jit.util" }
+	if ok then
+		jitlog.reasons = vmdef.traceerr
+	end
+	jit.attach( jitEvent, "trace" )
+end
+
+local function reportJitLog()
+	jit.attach( jitEvent )
+	print( "traces started: " .. jitlog.started .. " completed: " .. jitlog.stopped .. " aborted: " .. jitlog.aborted )
+	local keys = {}
+	for key in pairs(jitlog.aborts) do
+		keys[#keys+1] = key
+	end
+	table.sort( keys, function(a,b) return jitlog.aborts[a] > jitlog.aborts[b] end )
+	print "aborts\treason\tInterpreter.lua function:line\tSmalltalk method"
+	for i = 1, math.min( #keys, 60 ) do
+		print( jitlog.aborts[keys[i]] .. "\t" .. keys[i] )
+	end
+end
+
+local function cycle()
     checkProcessSwitch() 
+	if profiler and profiler.probe.samples ~= 0 then
+		sampleMethod()
+	end
+	if translator then
+		local t = translated[method]
+		if t and t.entries[instructionPointer] then
+			stackPointer, instructionPointer = t.fn( activeContext, homeContext, receiver, method, 
+				stackPointer, instructionPointer )
+			checkEvents() -- the translated code has no event checks of its own
+		end
+	end
 	currentBytecode = fetchByte()
 	cycleNr = cycleNr + 1
 	dispatchOnThisBytecode()
 end
 
+local function globalNamed( name )
+	local system = memory.knownObjects[0x12][1] -- the value of the Smalltalk association
+	for i = 0, system.count - 1 do
+		local assoc = system[i]
+		if type(assoc) == "table" and fetchClassOf(assoc[0]) == memory.knownObjects[0x38] and -- Symbol
+				ffi.string(C.St_toString( assoc[0].data )) == name then
+			return assoc
+		end
+	end
+end
+
+local function selectorNamed( cls, name )
+	while cls ~= nil do
+		local dictionary = cls[1] -- MessageDictionaryIndex
+		for i = 2, dictionary.count - 1 do -- SelectorStart
+			local sel = dictionary[i]
+			if sel ~= nil and ffi.string(C.St_toString( sel.data )) == name then
+				return sel
+			end
+		end
+		cls = superclassOf(cls)
+	end
+end
+
+local function endScript( status, text )
+	print( text )
+	RunStatus = status
+	eventFlags.word = bit.bor( eventFlags.word, 8 ) -- Stopped; the main loop calls St_stop on exit
+	runCheck = -1
+end
+
+-- Runs Compiler evaluate: RunScript in a context on top of the active one; the context is a 
+-- synthesized method "push Compiler, push script, send evaluate:", which is left as soon as the
+-- send returned to it, so the interrupted context continues as if nothing happened.
+local function startScript()
+	local compiler = globalNamed( "Compiler" )
+	local selector = compiler and selectorNamed( fetchClassOf( compiler[1] ), "evaluate:" )
+	if selector == nil then
+		endScript( 1, "ERROR: Compiler class>>evaluate: not found" )
+		return
+	end
+	local str = { data = memory.createArray(nil,#RunScript,false) }
+	ffi.copy(str.data.data, RunScript)
+	setmetatable( str, memory.knownObjects[0x0e] ) -- classString
+	
+	local m = { count = 3, header = 3 } -- three literals, no temporaries
+	setmetatable( m, memory.knownObjects[0x22] ) -- classCompiledMethod
+	m[0] = compiler
+	m[1] = str
+	m[2] = selector
+	m.bytecode = memory.createArray(nil,4,false)
+	m.bytecode.data[0] = 64 -- push literal variable 0
+	m.bytecode.data[1] = 33 -- push literal constant 1
+	m.bytecode.data[2] = 226 -- send literal selector 2 with one argument
+	m.bytecode.data[3] = 120 -- return self, never reached
+	
+	local ctx = { count = 6 + 12 }
+	setmetatable( ctx, memory.knownObjects[0x16] ) -- classMethodContext
+	ctx[0] = activeContext -- SenderIndex, so a notifier shows where the script came in
+	local iip = ( m.count + 1 ) * 2 + 1
+	storeInstructionPointerValueInContext( iip, ctx )
+	storeStackPointerValueInContext( 0, ctx )
+	ctx[3] = m -- MethodIndex
+	
+	runner.interrupted = activeContext
+	runner.context = ctx
+	runner.doneIP = iip - 1 + 3 -- after the send, see fetchContextRegisters
+	runner.startCycle = cycleNr
+	runner.startTicks = C.St_ticks()
+	newActiveContext( ctx )
+	print "running script"
+end
+
+local function runScript()
+	runCheck = cycleNr + 1
+	if runner.context == nil then
+		startScript()
+	elseif activeContext == runner.context and instructionPointer == runner.doneIP then
+		local result = activeContext[stackPointer]
+		local ms = C.St_ticks() - runner.startTicks
+		local cycles = cycleNr - runner.startCycle
+		newActiveContext( runner.interrupted )
+		runner.context[0] = nil -- SenderIndex
+		runner.context[1] = nil -- InstructionPointerIndex
+		endScript( 0, "result: " .. prettyValue(result) .. "\ntime [ms]: " .. tostring(ms) .. 
+			"\ncycles: " .. cycles )
+	elseif runner.limit > 0 and cycleNr - runner.startCycle >= runner.limit then
+		endScript( 1, "ERROR: script not finished after " .. runner.limit .. " cycles" )
+	end
+end
+
 function module.interpret()
 	C.St_start()
+	eventFlags = C.St_eventFlags()
 	cycleNr = 0
 	newProcessWaiting = false;
     local firstContext = activeProcess()[1] -- SuspendedContextIndex
 	newActiveContext( firstContext )
 	print "start main loop"
-	while C.St_isRunning() ~= 0 do -- and cycleNr < 121000 do 
+	if RunScript then
+		runner = { limit = RunCycles or 0 }
+		runCheck = RunWarmup
+	end
+	while bitand( eventFlags.word, 8 ) == 0 do -- Stopped; and cycleNr < 121000 do 
 		cycle()
-		C.St_processEvents()
+		if cycleNr == runCheck then
+			runScript()
+		end
 	end
 	C.St_stop()
 	print "quit main loop"
+	if profiler then
+		reportProfile()
+	end
+	if jitlog then
+		reportJitLog()
+	end
 end
 
 ---------------------- Primitives implementation -----------------------------------
@@ -1816,6 +2195,9 @@ function primitive.Become() -- primitiveBecome
 		temp = fetchClassOf(thisReceiver)
 		setmetatable(thisReceiver,fetchClassOf(otherPointer))
 		setmetatable(otherPointer,temp)
+		-- classes, selectors or methods might have swapped identity
+		flushMethodCache()
+		flushTranslations()
         push(thisReceiver)
     else
         unPop(2)
@@ -2012,7 +2394,7 @@ function primitive.Perform() -- primitivePerform
     messageSelector = newSelector
     -- ST_TRACE_PRIMITIVE("selector" << memory->prettyValue(newSelector).constData());
     local newReceiver = stackValue(argumentCount)
-    lookupMethodInClass( fetchClassOf(newReceiver) )
+    findNewMethodInClass( fetchClassOf(newReceiver) )
     success = success and argumentCountOf( newMethod ) == argumentCount - 1
     if success then
         local selectorIndex = stackPointer - argumentCount + 1
@@ -2043,7 +2425,7 @@ function primitive.PerformWithArgs() -- primitivePerformWithArgs
             push( argumentArray[index-1] )
             index = index + 1
         end
-    	lookupMethodInClass( fetchClassOf(thisReceiver) )
+    	findNewMethodInClass( fetchClassOf(thisReceiver) )
     	success = success and argumentCountOf( newMethod ) == argumentCount
         if success then
             executeNewMethod()
@@ -2131,7 +2513,8 @@ end
 primitive[88] = primitive.Suspend
 
 function primitive.FlushCache() -- primitiveFlushCache
-	-- NOP
+	-- receiver is the selector whose methods changed; no per selector index, so flush all
+	flushMethodCache()
 end
 primitive[89] = primitive.FlushCache
 
@@ -2179,6 +2562,239 @@ local RightMasks = { [0]=0, [1]=0x1, [2]=0x3, [3]=0x7, [4]=0xf,
        [9]=0x1ff, [10]=0x3ff, [11]=0x7ff, [12]=0xfff,
        [13]=0x1fff, [14]=0x3fff, [15]=0x7fff, [16]=0xffff }
        
+-- St_bitBlt runs the word parallel BitBlt of StDisplay.cpp which the C++ VM uses as well; its long 
+-- and branchy inner loops gain little from tracing. Set to false to run luaBitBlt instead.
+local useNativeBitBlt = true
+
+-- Lua version of St_bitBlt in StLjLibFfi.cpp; only used if useNativeBitBlt is false.
+-- The steps are file level functions which pass the state by parameters and results.
+
+local function bitBltClipRange( destX, destY, width, height, sourceX, sourceY, 
+								clipX, clipY, clipWidth, clipHeight, sourceBits, srcW, srcH )
+    -- answer sx/y, dx/y, w and h so that dest doesn't exceed clipping range and
+    -- source only covers what needed by clipped dest
+    local sx, sy, dx, dy, w, h
+    if destX >= clipX then
+        sx = sourceX
+        dx = destX
+        w = width
+    else
+        sx = sourceX + ( clipX - destX )
+        w = width - ( clipX - destX )
+        dx = clipX
+    end
+    if ( dx + w ) > ( clipX + clipWidth ) then
+        w = w - ( ( dx + w ) - ( clipX + clipWidth ) )
+    end
+    if destY >= clipY then
+        sy = sourceY
+        dy = destY
+        h = height
+    else
+        sy = sourceY + clipY - destY
+        h = height - clipY + destY
+        dy = clipY
+    end
+    if ( dy + h ) > ( clipY + clipHeight ) then
+        h = h - ( ( dy + h ) - ( clipY + clipHeight ) )
+    end
+    if sx < 0 then
+        dx = dx - sx;
+        w = w + sx;
+        sx = 0;
+    end
+    if sourceBits and ( sx + w ) > srcW then
+        w = w - ( sx + w - srcW )
+    end
+    if sy < 0 then
+        dy = dy - sy
+        h = h + sy
+        sy = 0
+    end
+    if sourceBits and ( sy + h ) > srcH then
+        h = h - ( sy + h - srcH )
+    end
+    return sx, sy, dx, dy, w, h
+end -- bitBltClipRange
+
+local function bitBltComputeMasks( destW, sourceBits, srcW, sx, dx, w )
+    local destRaster = mathfloor( ( ( destW - 1 ) / 16 ) + 1 )
+    local sourceRaster = 0
+    if sourceBits then
+        sourceRaster = mathfloor( ( ( srcW - 1 ) / 16 ) + 1 )
+    end
+    local skew = bitand( ( sx - dx ), 15 )
+    local startBits = 16 - bitand( dx , 15 )
+    local mask1 = RightMasks[ startBits ]
+    local endBits = 15 - bitand( ( dx + w - 1 ), 15 )
+    local mask2 = bit.bnot( RightMasks[ endBits ] )
+    local skewMask = 0
+    if skew ~= 0 then
+        skewMask = RightMasks[ 16 - skew  ]
+    end
+    local nWords
+    if w < startBits then
+        mask1 = bitand( mask1, mask2 )
+        mask2 = 0
+        nWords = 1
+    else
+        nWords = mathfloor( ( w - startBits + 15) / 16 + 1 )
+    end
+    return destRaster, sourceRaster, skew, mask1, mask2, skewMask, nWords
+end -- bitBltComputeMasks
+
+local function bitBltCheckOverlap( sameBits, sx, sy, dx, dy, w, h, skewMask, mask1, mask2 )
+    local hDir = 1
+    local vDir = 1
+    if sameBits and dy >= sy then
+        if dy > sy then
+            vDir = -1
+            sy = sy + h - 1
+            dy = dy + h - 1
+        elseif dx > sx then
+            hDir = -1
+            sx = sx + w - 1
+            dx = dx + w - 1
+            skewMask = bit.bnot(skewMask)
+            mask1, mask2 = mask2, mask1
+        end -- if
+    end -- if
+    return hDir, vDir, sx, sy, dx, dy, skewMask, mask1, mask2
+end -- bitBltCheckOverlap
+
+local function bitBltMerge(combinationRule, source, destination)
+    local bitnot = bit.bnot
+	if combinationRule == 0 then
+		return 0
+	elseif combinationRule == 1 then
+		return bitand(source, destination)
+	elseif combinationRule == 2 then
+		return bitand( source, bitnot(destination) )
+	elseif combinationRule == 3 then
+		return source
+	elseif combinationRule == 4 then
+		return bitand( bitnot(source), destination )
+	elseif combinationRule == 5 then
+		return destination
+	elseif combinationRule == 6 then
+		return bit.bxor( source, destination )
+	elseif combinationRule == 7 then
+		return bit.bor( source, destination )
+	elseif combinationRule == 8 then
+		return bitand( bitnot(source), bitnot(destination) )
+	elseif combinationRule == 9 then
+		return bit.bxor( bitnot(source), destination )
+	elseif combinationRule == 10 then
+		return bitnot(destination)
+	elseif combinationRule == 11 then
+		return bit.bor( source, bitnot(destination) )
+	elseif combinationRule == 12 then
+		return bitnot(source)
+	elseif combinationRule == 13 then
+		return bit.bor( bitnot(source), destination )
+	elseif combinationRule == 14 then
+		return bit.bor( bitnot(source), bitnot(destination) )
+	elseif combinationRule == 15 then
+		return 0xffff -- AllOnes
+	else
+		print "WARNING: unknown combination rule"
+		return 0
+	end
+end -- bitBltMerge
+
+local function bitBltCopyLoop( destBits, sourceBits, htBits, combinationRule, 
+							   sx, sy, dx, dy, h, hDir, vDir, 
+							   sourceRaster, destRaster, skew, skewMask, mask1, mask2, nWords )
+    local preload = ( sourceBits and skew ~= 0 and skew <= bitand( sx, 15 ) )
+    if hDir < 0 then
+        preload = preload == false
+    end
+    local sourceIndex = sy * sourceRaster + mathfloor( sx / 16 )
+    local destIndex = dy * destRaster + mathfloor( dx / 16 )
+    local off = 0
+    if preload then
+        off = 1
+    end
+    local sourceDelta = ( sourceRaster * vDir ) - ( (nWords + off ) * hDir )
+    local destDelta = ( destRaster * vDir ) - ( nWords * hDir )
+
+    local prevWord, thisWord, skewWord, mergeMask, halftoneWord, mergeWord
+    local bitor = bit.bor
+    local bitnot = bit.bnot
+    local lshift = bit.lshift
+    local rshift = bit.rshift
+    for i = 1, h do
+        if htBits then
+            halftoneWord = htBits.data[ bitand( dy, 15 ) ] -- left out +1 since we're 0 based
+            dy = dy + vDir
+        else
+            halftoneWord = 0xffff -- AllOnes
+        end
+        skewWord = halftoneWord
+        if preload and sourceBits then
+            prevWord = sourceBits.data[ sourceIndex ] -- left out +1
+            sourceIndex = sourceIndex + hDir
+        else
+            prevWord = 0
+        end
+        mergeMask = mask1;
+        for word = 1, nWords do
+            if sourceBits then
+                prevWord = bitand( prevWord, skewMask )
+                if word <= sourceRaster and sourceIndex >= 0 and 
+                    sourceIndex < sourceBits.count then
+                    thisWord = sourceBits.data[ sourceIndex ] -- left out +1
+                else
+                    thisWord = 0
+                end
+                skewWord = bitor( prevWord, bitand( thisWord, bitnot(skewMask) ) )
+                prevWord = thisWord
+                skewWord = bitor( lshift( skewWord, skew ), rshift( skewWord, -( skew - 16 ) ) )
+            end
+            if destIndex >= destBits.count then
+                return
+            end
+            local destWord =  destBits.data[ destIndex ] -- left out +1
+            mergeWord = bitBltMerge( combinationRule, bitand( skewWord, halftoneWord ), destWord )
+            destBits.data[ destIndex ] =  -- left out +1
+                bitor( bitand( mergeMask, mergeWord ), bitand( bitnot(mergeMask), destWord ) )
+            sourceIndex = sourceIndex + hDir
+            destIndex = destIndex + hDir
+            if word == ( nWords - 1 ) then
+                mergeMask = mask2
+            else
+                mergeMask = 0xffff -- AllOnes
+            end
+        end
+        sourceIndex = sourceIndex + sourceDelta
+        destIndex = destIndex + destDelta
+    end -- for
+end  -- bitBltCopyLoop
+
+local function luaBitBlt( destBits, destW, destH,
+                      sourceBits, srcW, srcH,
+                      htBits, htW, htH,
+                      combinationRule,
+                      destX, destY, width, height,
+                      sourceX, sourceY,
+                      clipX, clipY, clipWidth, clipHeight )
+    local sx, sy, dx, dy, w, h = bitBltClipRange( destX, destY, width, height, sourceX, sourceY, 
+    	clipX, clipY, clipWidth, clipHeight, sourceBits, srcW, srcH )
+    if w <= 0 or h <= 0 then
+        return
+    end
+    local destRaster, sourceRaster, skew, mask1, mask2, skewMask, nWords = 
+    	bitBltComputeMasks( destW, sourceBits, srcW, sx, dx, w )
+    local hDir, vDir
+    hDir, vDir, sx, sy, dx, dy, skewMask, mask1, mask2 = 
+    	bitBltCheckOverlap( sourceBits == destBits, sx, sy, dx, dy, w, h, skewMask, mask1, mask2 )
+    bitBltCopyLoop( destBits, sourceBits, htBits, combinationRule, sx, sy, dx, dy, h, hDir, vDir,
+    	sourceRaster, destRaster, skew, skewMask, mask1, mask2, nWords )
+    C.St_update( destBits,
+				  destX, destY, width, height,
+				  clipX, clipY, clipWidth, clipHeight )
+end -- luaBitBlt
+
 function primitive.CopyBits() -- primitiveCopyBits
 	local bitblt = stackTop()
 
@@ -2211,237 +2827,11 @@ function primitive.CopyBits() -- primitiveCopyBits
 	end
 
     --ST_TRACE_PRIMITIVE()
-    
-    ----[[
-    local function bitBlt( destBits, destW, destH,
-                          sourceBits, srcW, srcH,
-                          htBits, htW, htH,
-                          combinationRule,
-                          destX, destY, width, height,
-                          sourceX, sourceY,
-                          clipX, clipY, clipWidth, clipHeight )
-	    local sourceRaster
-        local destRaster
-        local skew, mask1, mask2, skewMask, nWords, vDir, hDir
-        local sx, sy, dx, dy, w, h -- pixel
-        local sourceIndex, destIndex, sourceDelta, destDelta
-        local preload
-
-	    local function clipRange()
-            -- set sx/y, dx/y, w and h so that dest doesn't exceed clipping range and
-            -- source only covers what needed by clipped dest
-            if destX >= clipX then
-                sx = sourceX
-                dx = destX
-                w = width
-            else
-                sx = sourceX + ( clipX - destX )
-                w = width - ( clipX - destX )
-                dx = clipX
-            end
-            if ( dx + w ) > ( clipX + clipWidth ) then
-                w = w - ( ( dx + w ) - ( clipX + clipWidth ) )
-            end
-            if destY >= clipY then
-                sy = sourceY
-                dy = destY
-                h = height
-            else
-                sy = sourceY + clipY - destY
-                h = height - clipY + destY
-                dy = clipY
-            end
-            if ( dy + h ) > ( clipY + clipHeight ) then
-                h = h - ( ( dy + h ) - ( clipY + clipHeight ) )
-            end
-            if sx < 0 then
-                dx = dx - sx;
-                w = w + sx;
-                sx = 0;
-            end
-            if sourceBits and ( sx + w ) > srcW then
-                w = w - ( sx + w - srcW )
-            end
-            if sy < 0 then
-                dy = dy - sy
-                h = h + sy
-                sy = 0
-            end
-            if sourceBits and ( sy + h ) > srcH then
-                h = h - ( sy + h - srcH )
-            end
-        end
-        
-        local function computeMasks()
-            destRaster = mathfloor( ( ( destW - 1 ) / 16 ) + 1 )
-            if sourceBits then
-                sourceRaster = mathfloor( ( ( srcW - 1 ) / 16 ) + 1 )
-            else
-	            sourceRaster = 0
-            end
-            skew = bitand( ( sx - dx ), 15 )
-            local startBits = 16 - bitand( dx , 15 )
-            mask1 = RightMasks[ startBits ]
-            local endBits = 15 - bitand( ( dx + w - 1 ), 15 )
-            mask2 = bit.bnot( RightMasks[ endBits ] )
-            if skew == 0 then
-	            skewMask = 0
-	        else
-	            skewMask = RightMasks[ 16 - skew  ]
-            end
-            if w < startBits then
-                mask1 = bitand( mask1, mask2 )
-                mask2 = 0
-                nWords = 1
-            else
-                nWords = mathfloor( ( w - startBits + 15) / 16 + 1 )
-            end
-        end
 
-		local function checkOverlap()
-            hDir = 1
-            vDir = 1
-            if sourceBits == destBits and dy >= sy then
-                if dy > sy then
-                    vDir = -1
-                    sy = sy + h - 1
-                    dy = dy + h - 1
-                elseif dx > sx then
-                    hDir = -1
-                    sx = sx + w - 1
-                    dx = dx + w - 1
-                    skewMask = bit.bnot(skewMask)
-                    local t = mask1
-                    mask1 = mask2
-                    mask2 = t
-                end -- if
-            end -- if
-        end -- checkOverlap
-   
-		local function calculateOffsets()
-            preload = ( sourceBits and skew ~= 0 and skew <= bitand( sx, 15 ) )
-            if hDir < 0 then
-                preload = preload == false
-            end
-            sourceIndex = sy * sourceRaster + mathfloor( sx / 16 )
-            destIndex = dy * destRaster + mathfloor( dx / 16 )
-            local off = 0
-            if preload then
-	            off = 1
-	        end
-            sourceDelta = ( sourceRaster * vDir ) - ( (nWords + off ) * hDir )
-            destDelta = ( destRaster * vDir ) - ( nWords * hDir )
-        end  -- calculateOffsets
-        
-	    local function copyLoop()
-            local prevWord, thisWord, skewWord, mergeMask, halftoneWord, mergeWord, word
-            local bitor = bit.bor
-            local bitnot = bit.bnot
-            local lshift = bit.lshift
-            local rshift = bit.rshift
-            local bitxor = bit.bxor
-            local function merge(combinationRule, source, destination)
-				if combinationRule == 0 then
-					return 0
-				elseif combinationRule == 1 then
-					return bitand(source, destination)
-				elseif combinationRule == 2 then
-					return bitand( source, bitnot(destination) )
-				elseif combinationRule == 3 then
-					return source
-				elseif combinationRule == 4 then
-					return bitand( bitnot(source), destination )
-				elseif combinationRule == 5 then
-					return destination
-				elseif combinationRule == 6 then
-					return bitxor( source, destination )
-				elseif combinationRule == 7 then
-					return bitor( source, destination )
-				elseif combinationRule == 8 then
-					return bitand( bitnot(source), bitnot(destination) )
-				elseif combinationRule == 9 then
-					return bitxor( bitnot(source), destination )
-				elseif combinationRule == 10 then
-					return bitnot(destination)
-				elseif combinationRule == 11 then
-					return bitor( source, bitnot(destination) )
-				elseif combinationRule == 12 then
-					return bitnot(source)
-				elseif combinationRule == 13 then
-					return bitor( bitnot(source), destination )
-				elseif combinationRule == 14 then
-					return bitor( bitnot(source), bitnot(destination) )
-				elseif combinationRule == 15 then
-					return 0xffff -- AllOnes
-				else
-					print "WARNING: unknown combination rule"
-					return 0
-				end
-			end -- merge
-            
-            for i = 1, h do
-                if htBits then
-                    halftoneWord = htBits.data[ bitand( dy, 15 ) ] -- left out +1 since we're 0 based
-                    dy = dy + vDir
-                else
-                    halftoneWord = 0xffff -- AllOnes
-                end
-                skewWord = halftoneWord
-                if preload and sourceBits then
-                    prevWord = sourceBits.data[ sourceIndex ] -- left out +1
-                    sourceIndex = sourceIndex + hDir
-                else
-                    prevWord = 0
-                end
-                mergeMask = mask1;
-                for word = 1, nWords do
-                    if sourceBits then
-                        prevWord = bitand( prevWord, skewMask )
-                        if word <= sourceRaster and sourceIndex >= 0 and 
-	                        sourceIndex < sourceBits.count then
-                            thisWord = sourceBits.data[ sourceIndex ] -- left out +1
-                        else
-                            thisWord = 0
-                        end
-                        skewWord = bitor( prevWord, bitand( thisWord, bitnot(skewMask) ) )
-                        prevWord = thisWord
-                        skewWord = bitor( lshift( skewWord, skew ), rshift( skewWord, -( skew - 16 ) ) )
-                    end
-                    if destIndex >= destBits.count then
-                        return
-                    end
-                    local destWord =  destBits.data[ destIndex ] -- left out +1
-                    mergeWord = merge( combinationRule, bitand( skewWord, halftoneWord ), destWord )
-                    destBits.data[ destIndex ] =  -- left out +1
-	                    bitor( bitand( mergeMask, mergeWord ), bitand( bitnot(mergeMask), destWord ) )
-                    sourceIndex = sourceIndex + hDir
-                    destIndex = destIndex + hDir
-                    if word == ( nWords - 1 ) then
-                        mergeMask = mask2
-                    else
-                        mergeMask = 0xffff -- AllOnes
-                    end
-                end
-                sourceIndex = sourceIndex + sourceDelta
-                destIndex = destIndex + destDelta
-            end -- for
-        end  -- copyLoop
-        
-        clipRange()
-	    if w <= 0 or h <= 0 then
-	        return
-	    end
-	    computeMasks()
-	    checkOverlap()
-	    calculateOffsets()
-	    copyLoop()
-	    C.St_update( destBits,
-					  destX, destY, width, height,
-					  clipX, clipY, clipWidth, clipHeight )
-	end -- bitBlt
-	--]]
-
-	--C.St_bitBlt( 
+	local bitBlt = luaBitBlt
+	if useNativeBitBlt then
+		bitBlt = C.St_bitBlt
+	end
 	bitBlt(
 		destBits, destW, destH, 
 		sourceBits, srcW, srcH, 
@@ -2455,7 +2845,21 @@ end
 primitive[96] = primitive.CopyBits
 
 function primitive.Snapshot() -- primitiveSnapshot
-	print "WARNING: primitiveSnapshot not yet implemented"
+	-- the image computes justSnapped from snapshotPrimitive isNil; saved with false so a restarted
+	-- image runs the startup code, the running system gets nil, see Interpreter::primitiveSnapshot
+	local receiver = popStack()
+	push( false )
+	storeContextRegisters()
+	activeProcess()[1] = activeContext -- SuspendedContextIndex
+	collectgarbage()
+	local ok = C.St_saveImage() ~= 0
+	popStack()
+	if ok then
+		push( nil )
+	else
+		push( receiver )
+		success = false
+	end
 end
 primitive[97] = primitive.Snapshot
 
@@ -2601,8 +3005,8 @@ function primitive.PosixFileOperation()
 			if success then
 				local byteArray = page[PageInPageIndex]
 				local position = (pageNumber - 1)*PageSize
-				if C.St_seekFile(fd,position) == position then
-					local read = C.St_readFile(fd,byteArray.data)
+				local read = C.St_readFileAt(fd,position,byteArray.data)
+				if read >= 0 then
 					page[BytesInPageIndex] = read
 					push(true)
 				else
@@ -2616,13 +3020,9 @@ function primitive.PosixFileOperation()
 			if success then
 				local byteArray = page[PageInPageIndex]
 				local position = (pageNumber - 1)*PageSize
-				if C.St_seekFile(fd,position) == position then
-					local toWrite = page[BytesInPageIndex]
-					local written = C.St_writeFile(fd,byteArray.data,toWrite)
-					push(written==toWrite)
-				else
-					push(false)
-				end
+				local toWrite = page[BytesInPageIndex]
+				local written = C.St_writeFileAt(fd,position,byteArray.data,toWrite)
+				push(written==toWrite)
 			end	
 		elseif code == 2 then -- truncate at page
 			local fd = file[DescriptorIndex]
@@ -2711,6 +3111,15 @@ function runInterpreter()
 		mathfloor = require("math").floor
 		classTrue = memory.knownObjects.True
 		classFalse = memory.knownObjects.False
+		if TranslateMethods then
+			translator = require "Translator"
+		end
+		if ProfileMethods then
+			profiler = { probe = C.St_profileProbe(), self = {}, interpreted = {}, stacks = {} }
+		end
+		if JitLog then
+			startJitLog()
+		end
 		module.interpret()
 	end
 end
@@ -34,8 +34,9 @@ ffi.cdef [[
 		uint16_t data[?];
 	} WordArray;
 	
-	void St_initByteArray( ByteArray* ba, int byteLen, void* data );
-        void St_initWordArray( WordArray* wa, int byteLen, void* data, int isBigEndian );
+	ByteArray* St_newByteArray( int byteLen, void* data );
+	WordArray* St_newWordArray( int byteLen, void* data, int isBigEndian );
+	void St_freeArray( void* body );
 	int St_loadImage(const char* path );
 ]]
 
@@ -47,26 +48,36 @@ module.WordArray = WordArray
 local arrayClasses = {} -- weak table to reference all existing ST objects
 arrayClasses.__mode = "kv" 
 
+-- the bodies come from the size class pool in StLjLibFfi.cpp instead of the GC heap and are 
+-- returned to it by the finalizer; arrays are pointers, so the data is shared when copied around
+local freeArray = C.St_freeArray
+
 function module.createArray( rawData, byteLen, isWord, isLittleEndian )
-	local ctype
-	local size
-	if isWord then
-		ctype = WordArray
-		size = byteLen / 2
-	else
-		ctype = ByteArray
-		size = byteLen
-	end
-		
 	local arr
 	if isWord then
-		arr = ffi.new( ctype, size ) 
-                ffi.C.St_initWordArray( arr, byteLen, rawData, isLittleEndian==true )
+		arr = C.St_newWordArray( byteLen, rawData, isLittleEndian==true )
 	else
-		arr = ffi.new( ctype, size + 1 ) -- add one byte for the zero
-		ffi.C.St_initByteArray( arr, byteLen, rawData ) 
+		arr = C.St_newByteArray( byteLen, rawData ) -- adds one byte for the zero
+	end
+	if arr == nil then
+		error( "not enough memory" )
+	end
+	return ffi.gc( arr, freeArray )
+end
+
+-- called once by LjObjectMemory::readFrom; list holds four entries per object: the object, the raw
+-- data (light userdata), the byte length and the kind (0 byte object, 1 word object, 2 method bytecode)
+function module.createArrays( list, count, isBigEndian )
+	local createArray = module.createArray
+	for i = 1, count, 4 do
+		local obj = list[i]
+		local kind = list[i+3]
+		if kind == 2 then
+			rawset( obj, "bytecode", createArray( list[i+1], list[i+2], false ) )
+		else
+			rawset( obj, "data", createArray( list[i+1], list[i+2], kind == 1, isBigEndian ) )
+		end
 	end
-	return arr
 end
 
 module.allObjects = {} -- weak table to reference all existing ST objects
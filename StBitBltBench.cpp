@@ -0,0 +1,316 @@
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StDisplay.h"
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QStringList>
+#include <QTextStream>
+#include <QVector>
+#include <QtDebug>
+using namespace St;
+
+// Drives BitBlt::copyBits with a matrix of alignments, widths, rules, halftone and overlap
+// and reports the throughput of each case. Each case is also checked bit for bit against
+// BitBlt::referenceCopyBits and against a pixel by pixel model of the operation; the latter
+// is the arbiter, since the textbook loop is known to get some overlaps wrong.
+
+enum { ScreenWidth = 640, ScreenHeight = 480, BlitHeight = 32, HalftoneSize = 16 };
+
+struct Form
+{
+    QVector<quint8> d_bytes;
+    quint16 d_width, d_height;
+    Form( quint16 w = 0, quint16 h = 0 ):d_width(w),d_height(h)
+    {
+        d_bytes.resize( ( ( w + 15 ) / 16 ) * 2 * h );
+    }
+    Bitmap bitmap()
+    {
+        return Bitmap( d_bytes.data(), d_bytes.size() / 2, d_width, d_height );
+    }
+    int lineBytes() const { return ( ( d_width + 15 ) / 16 ) * 2; }
+    bool test( int x, int y ) const
+    {
+        return ( d_bytes[ y * lineBytes() + ( x >> 3 ) ] >> ( 7 - ( x & 7 ) ) ) & 1;
+    }
+    void set( int x, int y, bool on )
+    {
+        quint8& b = d_bytes[ y * lineBytes() + ( x >> 3 ) ];
+        const quint8 m = 0x80 >> ( x & 7 );
+        if( on )
+            b |= m;
+        else
+            b &= ~m;
+    }
+    void fill( quint32 seed )
+    {
+        for( int i = 0; i < d_bytes.size(); i++ )
+        {
+            seed = seed * 1103515245 + 12345;
+            d_bytes[i] = seed >> 16;
+        }
+    }
+};
+
+enum Mode { Separate, HalftoneOnly, OverlapRight, OverlapLeft, OverlapDown, OverlapUp, ModeCount };
+static const char* s_modeNames[] = { "separate", "halftone", "ovl-right", "ovl-left", "ovl-down", "ovl-up" };
+
+struct Case
+{
+    Mode mode;
+    int rule, width, dx, sx;
+    bool halftone;
+    int dy, sy;
+};
+
+static inline bool mergeBit( int rule, bool source, bool dest )
+{
+    // bit 3 - ( 2 * source + dest ) of the rule is the result, see Blue Book table 18.1
+    return ( rule >> ( 3 - ( ( source ? 2 : 0 ) + ( dest ? 1 : 0 ) ) ) ) & 1;
+}
+
+static void modelCopy( const Case& c, const Form& source, const Form& halftone, Form& dest, bool withSource )
+{
+    const Form before = source; // overlapping source is read before anything is written
+    for( int y = 0; y < BlitHeight; y++ )
+    {
+        for( int x = 0; x < c.width; x++ )
+        {
+            bool s = true;
+            if( withSource )
+                s = before.test( c.sx + x, c.sy + y );
+            if( c.halftone )
+                s = s && halftone.test( ( c.dx + x ) & 15, ( c.dy + y ) & 15 );
+            dest.set( c.dx + x, c.dy + y, mergeBit( c.rule, s, dest.test( c.dx + x, c.dy + y ) ) );
+        }
+    }
+}
+
+static BitBlt::Input makeInput( const Case& c, const Bitmap* source, Bitmap* dest, const Bitmap* halftone )
+{
+    BitBlt::Input in;
+    in.sourceBits = source;
+    in.destBits = dest;
+    in.halftoneBits = halftone;
+    in.combinationRule = c.rule;
+    in.destX = c.dx;
+    in.destY = c.dy;
+    in.sourceX = c.sx;
+    in.sourceY = c.sy;
+    in.width = c.width;
+    in.height = BlitHeight;
+    in.clipX = 0;
+    in.clipY = 0;
+    in.clipWidth = ScreenWidth;
+    in.clipHeight = ScreenHeight;
+    return in;
+}
+
+// returns 0 if all agree, 1 if copyBits differs from the model, 2 if only the reference does
+static int check( const Case& c, const Form& screen, const Form& other, const Form& halftone )
+{
+    const bool same = c.mode >= OverlapRight;
+    const bool withSource = c.mode != HalftoneOnly;
+
+    Form fast = same ? screen : other;
+    Form fastDest = screen;
+    Form ref = same ? screen : other;
+    Form refDest = screen;
+    Form model = screen;
+    Form ht = halftone;
+    Bitmap htBm = ht.bitmap();
+
+    Bitmap fastSrc = fast.bitmap();
+    Bitmap fastDst = same ? fastSrc : fastDest.bitmap();
+    BitBlt bb1( makeInput( c, withSource ? &fastSrc : 0, &fastDst, c.halftone ? &htBm : 0 ) );
+    bb1.copyBits();
+
+    Bitmap refSrc = ref.bitmap();
+    Bitmap refDst = same ? refSrc : refDest.bitmap();
+    BitBlt bb2( makeInput( c, withSource ? &refSrc : 0, &refDst, c.halftone ? &htBm : 0 ) );
+    bb2.referenceCopyBits();
+
+    modelCopy( c, same ? screen : other, halftone, model, withSource );
+
+    const Form& fastResult = same ? fast : fastDest;
+    const Form& refResult = same ? ref : refDest;
+    if( fastResult.d_bytes != model.d_bytes )
+        return 1;
+    if( refResult.d_bytes != model.d_bytes )
+        return 2;
+    return 0;
+}
+
+static double measure( const Case& c, Form& screen, Form& other, Form& halftone, int minMs )
+{
+    const bool same = c.mode >= OverlapRight;
+    const bool withSource = c.mode != HalftoneOnly;
+    Bitmap dst = screen.bitmap();
+    Bitmap src = same ? dst : other.bitmap();
+    Bitmap ht = halftone.bitmap();
+    const BitBlt::Input in = makeInput( c, withSource ? &src : 0, &dst, c.halftone ? &ht : 0 );
+
+    QElapsedTimer t;
+    t.start();
+    qint64 reps = 0;
+    int batch = 16;
+    while( true )
+    {
+        for( int i = 0; i < batch; i++ )
+        {
+            BitBlt bb( in );
+            bb.copyBits();
+        }
+        reps += batch;
+        if( t.elapsed() >= minMs )
+            break;
+        batch *= 2;
+    }
+    return double( t.nsecsElapsed() ) / ( double(reps) * c.width * BlitHeight ); // ns per pixel
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("me@rochus-keller.ch");
+    a.setOrganizationDomain("github.com/rochus-keller/Smalltalk");
+    a.setApplicationName("Smalltalk 80 BitBlt Benchmark");
+    a.setApplicationVersion("0.1");
+
+    QTextStream out(stdout);
+    bool checkOnly = false;
+    int onlyRule = -1;
+    int minMs = 20;
+    const QStringList args = QCoreApplication::arguments();
+    for( int i = 1; i < args.size(); i++ )
+    {
+        if( args[i] == "-h" )
+        {
+            out << a.applicationName() << " version: " << a.applicationVersion() <<
+                   " author: me@rochus-keller.ch  license: GPL" << endl;
+            out << "usage: [options]" << endl;
+            out << "options:" << endl;
+            out << "  -check    only compare results, no timing" << endl;
+            out << "  -rule n   only run combination rule n" << endl;
+            out << "  -ms n     minimum measuring time per case (default 20)" << endl;
+            out << "  -h        display this information" << endl;
+            return 0;
+        }else if( args[i] == "-check" )
+            checkOnly = true;
+        else if( args[i] == "-rule" && i + 1 < args.size() )
+            onlyRule = args[++i].toInt();
+        else if( args[i] == "-ms" && i + 1 < args.size() )
+            minMs = args[++i].toInt();
+        else
+        {
+            qCritical() << "error: invalid command line option " << args[i] << endl;
+            return -1;
+        }
+    }
+
+    Form screen( ScreenWidth, ScreenHeight );
+    Form other( ScreenWidth, ScreenHeight );
+    Form halftone( HalftoneSize, HalftoneSize );
+    screen.fill( 1 );
+    other.fill( 2 );
+    halftone.fill( 3 );
+
+    static const int widths[] = { 1, 7, 16, 33, 100, 512 };
+    static const int destAligns[] = { 0, 5, 15 };
+    static const int sourceAligns[] = { 0, 3, 15 };
+
+    out << "mode       rule ht  width dx sx    ns/pix   Mpix/s  result" << endl;
+    int cases = 0, failed = 0, refFailed = 0;
+    double totalNs = 0;
+    for( int mode = 0; mode < ModeCount; mode++ )
+    {
+        for( int rule = 0; rule < 16; rule++ )
+        {
+            if( onlyRule >= 0 && rule != onlyRule )
+                continue;
+            for( int ht = 0; ht < 2; ht++ )
+            {
+                if( mode == HalftoneOnly && ht == 0 )
+                    continue; // BitBlt requires a source or a halftone
+                for( int wi = 0; wi < int(sizeof(widths)/sizeof(int)); wi++ )
+                {
+                    for( int di = 0; di < 3; di++ )
+                    {
+                        for( int si = 0; si < 3; si++ )
+                        {
+                            if( mode == HalftoneOnly && si != 0 )
+                                continue;
+                            Case c;
+                            c.mode = Mode(mode);
+                            c.rule = rule;
+                            c.halftone = ht;
+                            c.width = widths[wi];
+                            c.dx = 64 + destAligns[di];
+                            c.sx = 32 + sourceAligns[si];
+                            c.dy = c.sy = 100;
+                            switch( mode )
+                            {
+                            case OverlapRight: // source left of destination in the same rows
+                                c.sx = c.dx - 1 - sourceAligns[si];
+                                break;
+                            case OverlapLeft:
+                                c.sx = c.dx + 1 + sourceAligns[si];
+                                break;
+                            case OverlapDown:
+                                c.sy = c.dy - 3;
+                                break;
+                            case OverlapUp:
+                                c.sy = c.dy + 3;
+                                break;
+                            default:
+                                break;
+                            }
+
+                            const int res = check( c, screen, other, halftone );
+                            cases++;
+                            if( res == 1 )
+                                failed++;
+                            else if( res == 2 )
+                                refFailed++;
+                            const char* result = res == 0 ? "ok" : res == 1 ? "MISMATCH" : "reference differs";
+
+                            out << QString("%1 %2 %3 %4 %5 %6 ")
+                                   .arg( QString::fromLatin1(s_modeNames[mode]), -10 ).arg( rule, 4 ).arg( QString::fromLatin1(ht ? "yes" : "no"), 3 )
+                                   .arg( c.width, 6 ).arg( destAligns[di], 2 ).arg( c.sx & 15, 2 );
+                            if( !checkOnly )
+                            {
+                                const double ns = measure( c, screen, other, halftone, minMs );
+                                totalNs += ns;
+                                out << QString("%1 %2  ").arg( ns, 9, 'f', 3 ).arg( 1000.0 / ns, 8, 'f', 1 );
+                            }else
+                                out << QString(20, QChar(' '));
+                            out << result << endl;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    out << endl << cases << " cases, " << failed << " mismatches, " << refFailed <<
+           " where only the reference implementation differs" << endl;
+    if( !checkOnly && cases )
+        out << "mean " << QString::number( totalNs / cases, 'f', 3 ) << " ns/pixel" << endl;
+    return failed == 0 ? 0 : 1;
+}
@@ -21,6 +21,9 @@
 #include <QFile>
 #include <QPainter>
 #include <stdint.h>
+#include <string.h>
+#include <QThreadPool>
+#include <QThread>
 #include <QtDebug>
 #include <QBitmap>
 #include <QMessageBox>
@@ -28,9 +31,14 @@
 #include <QCloseEvent>
 #include <QShortcut>
 #include <QClipboard>
+#if defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 )
+#define ST_BITBLT_SSE2 // baseline on x86-64, so no runtime check is needed
+#include <emmintrin.h>
+#endif
 using namespace St;
 
-#define _USE_BB_IMP_
+#define ST_PARALLEL_BITBLT // split large blits into row stripes run on a thread pool
+// #define _USE_BB_IMP_ // use the Blue Book copy loop (BitBlt::referenceCopyBits) instead of the word parallel one
 
 static Display* s_inst = 0;
 bool Display::s_run = true;
@@ -57,7 +65,7 @@ void messageHander(QtMsgType type, const QMessageLogContext& ctx, const QString&
 }
 
 Display::Display(QWidget *parent) : QWidget(parent),d_curX(-1),d_curY(-1),d_capsLockDown(false),
-    d_shiftDown(false),d_recOn(false),d_forceClose(false),d_eventCb(0)
+    d_shiftDown(false),d_forceClose(false),d_eventCb(0)
 {
     setMouseTracking(true);
     setFocusPolicy(Qt::StrongFocus);
@@ -66,7 +74,8 @@ Display::Display(QWidget *parent) : QWidget(parent),d_curX(-1),d_curY(-1),d_caps
     show();
     d_lastEvent = 0;
     d_elapsed.start();
-    // startTimer(s_msPerFrame);
+    d_frameTimer = 0;
+    setFrameRate( DefaultFrameRate );
 #ifndef ST_DISPLAY_WORDARRY
     new QShortcut(tr("ALT+R"), this, SLOT(onRecord()) );
     new QShortcut(tr("ALT+L"), this, SLOT(onLog()) );
@@ -112,7 +121,14 @@ void Display::setBitmap(const Bitmap& buf)
     d_bitmap = buf;
     d_screen = QImage( buf.width(), buf.height(), QImage::Format_RGB32 );
     d_bitmap.toImage(d_screen);
-    d_updateArea = QRect();
+    d_damage.clear();
+    if( d_recorder.isOpen() )
+        d_recorder.record( d_bitmap, QRect( 0, 0, d_bitmap.width(), d_bitmap.height() ), getTicks() );
+    else if( !d_recordPath.isEmpty() )
+    {
+        startRecording( d_recordPath );
+        d_recordPath.clear();
+    }
     setFixedSize( buf.width(), buf.height() );
     update();
 }
@@ -133,23 +149,102 @@ void Display::setCursorPos(qint16 x, qint16 y)
     update();
 }
 
-void Display::drawRecord(int x, int y, int w, int h)
+bool Display::startRecording(const QString& path)
 {
-    if( !d_recOn )
-        return;
-    QPainter p(&d_record);
-    if( w < 0 || h < 0 )
-        p.setPen(Qt::red);
-    else
-        p.setPen(Qt::green);
-    p.drawRect(x,y,w,h);
+    if( d_bitmap.isNull() )
+    {
+        // starts with the first setBitmap
+        d_recordPath = path;
+        return true;
+    }
+    if( !d_recorder.open( path, d_bitmap.width(), d_bitmap.height() ) )
+        return false;
+    flushDamage();
+    d_recorder.record( d_bitmap, QRect( 0, 0, d_bitmap.width(), d_bitmap.height() ), getTicks() );
+    return true;
+}
+
+void Display::stopRecording()
+{
+    flushDamage();
+    d_recorder.close();
+}
+
+void Display::recordArea(const QRect& r)
+{
+    d_recorder.record( d_bitmap, r, getTicks() );
 }
 
 void Display::updateArea(const QRect& r )
 {
-    d_updateArea |= r;
+    // only collect the damage here; conversion and paint happen once per frame in flushDamage
+    QRect n = r & QRect( 0, 0, d_screen.width(), d_screen.height() );
+    if( n.isEmpty() )
+        return;
+    // absorb all rects which overlap or touch the new one, until none is left
+    int i = 0;
+    while( i < d_damage.size() )
+    {
+        if( d_damage[i].adjusted( -1, -1, 1, 1 ).intersects( n ) )
+        {
+            n |= d_damage[i];
+            d_damage.removeAt(i);
+            i = 0;
+        }else
+            i++;
+    }
+    if( d_damage.size() >= MaxDamageRects )
+    {
+        // too fragmented; merge with the rect whose bounding box grows least
+        int best = 0;
+        qint64 bestGrowth = -1;
+        for( i = 0; i < d_damage.size(); i++ )
+        {
+            const QRect u = d_damage[i] | n;
+            const qint64 growth = qint64(u.width()) * u.height()
+                    - qint64(d_damage[i].width()) * d_damage[i].height();
+            if( bestGrowth < 0 || growth < bestGrowth )
+            {
+                best = i;
+                bestGrowth = growth;
+            }
+        }
+        n |= d_damage[best];
+        d_damage.removeAt(best);
+    }
+    d_damage.append(n);
+}
 
-    update( r );
+void Display::flushDamage()
+{
+    if( d_damage.isEmpty() || d_bitmap.isNull() )
+        return;
+    for( int i = 0; i < d_damage.size(); i++ )
+    {
+        d_bitmap.toImage( d_screen, d_damage[i] );
+        update( d_damage[i] );
+        if( d_recorder.isOpen() )
+            d_recorder.record( d_bitmap, d_damage[i], getTicks() );
+    }
+    d_damage.clear();
+}
+
+void Display::setFrameRate(int hz)
+{
+    if( hz < MinFrameRate )
+        hz = MinFrameRate;
+    else if( hz > MaxFrameRate )
+        hz = MaxFrameRate;
+    d_msPerFrame = 1000 / hz;
+    if( d_frameTimer )
+        killTimer( d_frameTimer );
+    d_frameTimer = startTimer( d_msPerFrame, Qt::PreciseTimer );
+}
+
+const QImage&Display::getScreen()
+{
+    flushDamage();
+    return d_screen;
 }
 
 void Display::setLog(bool on)
@@ -162,23 +257,31 @@ void Display::setLog(bool on)
 
 void Display::processEvents()
 {
-    static quint32 last = 0;
     static quint32 count = 0;
 
     if( count > 4000 )
     {
         count = 0;
-        Display* d = Display::inst();
-        const quint32 cur = d->d_elapsed.elapsed();
-        if( ( cur - last ) >= 30 )
-        {
-            last = cur;
-            QApplication::processEvents();
-        }
+        pollEvents();
     }else
         count++;
 }
 
+bool Display::pollEvents()
+{
+    static quint32 last = 0;
+
+    Display* d = Display::inst();
+    const quint32 cur = d->d_elapsed.elapsed();
+    if( ( cur - last ) >= quint32(d->d_msPerFrame) )
+    {
+        last = cur;
+        QApplication::processEvents();
+        return true;
+    }
+    return false;
+}
+
 void Display::copyToClipboard(const QByteArray& str)
 {
     QString text = QString::fromUtf8(str);
@@ -188,17 +291,14 @@ void Display::copyToClipboard(const QByteArray& str)
 
 void Display::onRecord()
 {
-    if( !d_recOn )
+    if( !d_recorder.isOpen() )
     {
-        qWarning() << "record on";
-        d_recOn = true;
-        d_record = d_screen.convertToFormat(QImage::Format_RGB32);
+        if( startRecording( "screen.strec" ) )
+            qWarning() << "record on";
     }else
     {
         qWarning() << "record off";
-        d_record.save("record.png");
-        d_record = QImage();
-        d_recOn = false;
+        stopRecording();
     }
 }
 
@@ -264,12 +364,6 @@ void Display::paintEvent(QPaintEvent* event)
     if( r.isNull() )
         return;
 
-    if( !d_updateArea.isNull() )
-    {
-        d_bitmap.toImage( d_screen, d_updateArea );
-        d_updateArea = QRect();
-    }
-
     QPainter p(this);
     p.setRenderHints( QPainter::Antialiasing | QPainter::TextAntialiasing | QPainter::SmoothPixmapTransform, false );
 
@@ -303,9 +397,10 @@ void Display::paintEvent(QPaintEvent* event)
     p.drawImage( r,d_screen, r);
 }
 
-void Display::timerEvent(QTimerEvent*)
+void Display::timerEvent(QTimerEvent* event)
 {
-    // update();
+    if( event->timerId() == d_frameTimer )
+        flushDamage();
 }
 
 void Display::closeEvent(QCloseEvent* event)
@@ -673,6 +768,56 @@ void Display::notify()
         d_eventCb();
 }
 
+// 1 bit per pixel to RGB32 expansion; whole bytes are copied as eight precomputed pixels
+static const uint Black = 0xff000000;
+static const uint White = 0xffffffff;
+struct ExpandTable
+{
+    uint d_pix[256][8];
+    ExpandTable()
+    {
+        for( int b = 0; b < 256; b++ )
+            for( int i = 0; i < 8; i++ )
+                d_pix[b][i] = ( ( b >> ( 7 - i ) ) & 1 ) ? Black : White;
+    }
+};
+static const ExpandTable s_expand;
+
+struct ByteRow
+{
+    const quint8* d_data;
+    ByteRow( const quint8* data ):d_data(data) {}
+    inline quint8 byte( int i ) const { return d_data[i]; }
+};
+
+struct WordRow
+{
+    const quint16* d_data;
+    WordRow( const quint16* data ):d_data(data) {}
+    inline quint8 byte( int i ) const { return ( i & 1 ) ? d_data[i>>1] & 0xff : d_data[i>>1] >> 8; }
+};
+
+template<class Row>
+static inline void expandRow( const Row& row, uint* p, int x, int end )
+{
+    while( x < end && ( x & 7 ) )
+    {
+        *p++ = s_expand.d_pix[row.byte(x>>3)][x & 7];
+        x++;
+    }
+    while( x + 8 <= end )
+    {
+        ::memcpy( p, s_expand.d_pix[row.byte(x>>3)], 8 * sizeof(uint) );
+        p += 8;
+        x += 8;
+    }
+    while( x < end )
+    {
+        *p++ = s_expand.d_pix[row.byte(x>>3)][x & 7];
+        x++;
+    }
+}
+
 #ifndef ST_DISPLAY_WORDARRY
 Bitmap::Bitmap(quint8* buf, quint16 wordLen, quint16 pixWidth, quint16 pixHeight)
 {
@@ -730,10 +875,7 @@ void Bitmap::toImage(QImage& img, QRect area) const
     dest_data += dw * ay;
     for( int y = 0; y < ah; y++ )
     {
-        uint*p = (uint*)dest_data;
-        p += ax;
-        for( int x = ax; x < axaw; x++ )
-            *p++ = ((src_data[x>>3] >> (7 - (x & 7))) & 1) ? 0xff000000 : 0xffffffff;
+        expandRow( ByteRow(src_data), (uint*)dest_data + ax, ax, axaw );
         src_data += sw;
         dest_data += dw;
     }
@@ -780,10 +922,7 @@ void Bitmap::toImage(QImage& img, QRect area) const
     dest_data += dw * ay;
     for( int y = 0; y < ah; y++ )
     {
-        uint*p = (uint*)dest_data;
-        p += ax;
-        for( int x = ax; x < axaw; x++ )
-            *p++ = ((src_data[x>>4] >> (15 - (x & 15))) & 1) ? 0xff000000 : 0xffffffff; // 15 statt 7
+        expandRow( WordRow(src_data), (uint*)dest_data + ax, ax, axaw );
         src_data += sw;
         dest_data += dw;
     }
@@ -803,6 +942,18 @@ BitBlt::BitBlt(const Input& in):
 }
 
 void BitBlt::copyBits()
+{
+#ifdef _USE_BB_IMP_
+    referenceCopyBits();
+#else
+    clipRange();
+    if( w <= 0 || h <= 0 )
+        return;
+    copyLoop();
+#endif
+}
+
+void BitBlt::referenceCopyBits()
 {
     clipRange();
     if( w <= 0 || h <= 0 )
@@ -810,7 +961,7 @@ void BitBlt::copyBits()
     computeMasks();
     checkOverlap();
     calculateOffsets();
-    copyLoop();
+    referenceLoop();
 }
 
 void BitBlt::clipRange()
@@ -927,9 +1078,260 @@ void BitBlt::calculateOffsets()
     destDelta = ( destRaster * vDir ) - ( nWords * hDir );
 }
 
-void BitBlt::copyLoop()
+struct BitBlt::AnyRule
+{
+    enum { UsesSource = 1, IsStore = 0, IsFill = 0 };
+    const quint16 rule;
+    AnyRule( quint16 r ):rule(r) {}
+    inline quint16 apply( quint16 source, quint16 destination ) const { return merge( rule, source, destination ); }
+};
+
+struct RuleClear
+{
+    enum { UsesSource = 0, IsStore = 0, IsFill = 1 };
+    inline quint16 apply( quint16, quint16 ) const { return 0; }
+};
+
+struct RuleStore
+{
+    enum { UsesSource = 1, IsStore = 1, IsFill = 0 };
+    inline quint16 apply( quint16 source, quint16 ) const { return source; }
+};
+
+struct RuleErase
+{
+    enum { UsesSource = 1, IsStore = 0, IsFill = 0 };
+    inline quint16 apply( quint16 source, quint16 destination ) const { return ~source & destination; }
+};
+
+struct RuleReverse
+{
+    enum { UsesSource = 1, IsStore = 0, IsFill = 0 };
+    inline quint16 apply( quint16 source, quint16 destination ) const { return source ^ destination; }
+};
+
+struct RuleUnder
+{
+    enum { UsesSource = 1, IsStore = 0, IsFill = 0 };
+    inline quint16 apply( quint16 source, quint16 destination ) const { return source | destination; }
+};
+
+struct RuleSet
+{
+    enum { UsesSource = 0, IsStore = 0, IsFill = 1 };
+    inline quint16 apply( quint16, quint16 ) const { return 0xffff; }
+};
+
+// 128 bit version of the middle words of the bitwise rules, eight words per step. The byte order of the
+// words doesn't matter to bitwise operations, only the halftone has to be laid out like in the buffer.
+// Answers the number of words done; the caller does the rest word by word.
+template<class Rule>
+static inline int vectorWords( const Rule&, void*, const void*, int, quint16 )
+{
+    return 0; // no 128 bit version
+}
+
+#ifdef ST_BITBLT_SSE2
+struct VectorStore
+{
+    static inline __m128i apply( __m128i source, __m128i ) { return source; }
+};
+
+struct VectorErase
+{
+    static inline __m128i apply( __m128i source, __m128i destination ) { return _mm_andnot_si128( source, destination ); }
+};
+
+struct VectorReverse
+{
+    static inline __m128i apply( __m128i source, __m128i destination ) { return _mm_xor_si128( source, destination ); }
+};
+
+struct VectorUnder
+{
+    static inline __m128i apply( __m128i source, __m128i destination ) { return _mm_or_si128( source, destination ); }
+};
+
+template<class Op>
+static int vectorLoop( void* dest, const void* source, int words, quint16 halftone )
+{
+    // source is 0 if the rule only merges the halftone; when source and dest overlap source is right
+    // of dest (see checkOverlap), so each load happens before the stores which could reach it
+    const __m128i pattern = _mm_set1_epi16( short( Bitmap::inMemory( halftone ) ) );
+    const int n = words & ~7;
+    quint8* d = (quint8*)dest;
+    const quint8* s = (const quint8*)source;
+    for( int i = 0; i < n * 2; i += 16 )
+    {
+        __m128i src = pattern;
+        if( s )
+            src = _mm_and_si128( src, _mm_loadu_si128( (const __m128i*)( s + i ) ) );
+        __m128i* p = (__m128i*)( d + i );
+        _mm_storeu_si128( p, Op::apply( src, _mm_loadu_si128( p ) ) );
+    }
+    return n;
+}
+
+static inline int vectorWords( const RuleStore&, void* d, const void* s, int n, quint16 ht )
+{
+    return vectorLoop<VectorStore>( d, s, n, ht );
+}
+
+static inline int vectorWords( const RuleErase&, void* d, const void* s, int n, quint16 ht )
+{
+    return vectorLoop<VectorErase>( d, s, n, ht );
+}
+
+static inline int vectorWords( const RuleReverse&, void* d, const void* s, int n, quint16 ht )
+{
+    return vectorLoop<VectorReverse>( d, s, n, ht );
+}
+
+static inline int vectorWords( const RuleUnder&, void* d, const void* s, int n, quint16 ht )
+{
+    return vectorLoop<VectorUnder>( d, s, n, ht );
+}
+#endif
+
+template<class Rule>
+void BitBlt::putWord(const Rule& rule, int i, quint16 source, quint16 mask)
+{
+    const quint16 destWord = destBits->word( i );
+    destBits->setWord( i, ( mask & rule.apply( source, destWord ) ) | ( ~mask & destWord ) );
+}
+
+template<class Rule>
+void BitBlt::copyWords(const Rule& rule, int from, int to)
+{
+    // Each destination word pulls its 16 source bits from the two source words it straddles;
+    // since the skew is the same for every word, the second word of one step is the first
+    // word of the next, so each source word is read only once. Rows are independent, so
+    // overlap only dictates the order in which rows and words are visited (see copyLoop).
+    const int delta = sx - dx;
+    const int shift = delta & 15;
+    const int wordOff = delta >> 4; // rounds towards minus infinity
+    const int first = dx >> 4;
+    const int last = ( dx + w - 1 ) >> 4;
+    const quint16 firstMask = quint16( 0xffff >> ( dx & 15 ) );
+    const quint16 lastMask = quint16( 0xffff << ( 15 - ( ( dx + w - 1 ) & 15 ) ) );
+    const int destLen = destBits->wordLen();
+
+    const bool withSource = sourceBits != 0 && Rule::UsesSource;
+    const quint16 edge1 = first == last ? quint16( firstMask & lastMask ) : firstMask;
+
+    for( int i = from; i < to; i++ )
+    {
+        const int row = vDir > 0 ? i : h - 1 - i;
+        const int destBase = ( dy + row ) * destRaster;
+        if( destBase + first < 0 || destBase + last >= destLen )
+            continue;
+        const int sourceBase = ( sy + row ) * sourceRaster;
+        const quint16 halftoneWord = halftoneBits != 0 ? halftoneBits->wordAt( 1 + ( ( dy + row ) & 15 ) ) : AllOnes;
+
+        if( hDir > 0 )
+        {
+            // first word, masked
+            quint16 hi = withSource ? sourceWord( sourceBase, first + wordOff ) : 0;
+            quint16 src = halftoneWord;
+            if( withSource )
+            {
+                if( shift )
+                {
+                    const quint16 lo = sourceWord( sourceBase, first + wordOff + 1 );
+                    src &= quint16( ( hi << shift ) | ( lo >> ( 16 - shift ) ) );
+                    hi = lo;
+                }else
+                    src &= hi;
+            }
+            putWord( rule, destBase + first, src, edge1 );
+            if( first == last )
+                continue;
+
+            // middle words, all bits used, so all source words involved are inside the row
+            const int from = destBase + first + 1;
+            const int to = destBase + last; // exclusive
+            const int s = sourceBase + wordOff; // source word index = s + dest index - destBase
+            if( !withSource )
+            {
+                if( Rule::IsFill )
+                {
+                    // the result is all zeros or all ones in any byte order
+                    if( to > from )
+                        ::memset( destBits->wordPtr( from ), quint8( rule.apply( 0, 0 ) ), ( to - from ) * 2 );
+                }else
+                {
+                    int d = from;
+                    if( to > from )
+                        d += vectorWords( rule, destBits->wordPtr( from ), 0, to - from, halftoneWord );
+                    for( ; d < to; d++ )
+                        destBits->setWord( d, rule.apply( halftoneWord, destBits->word( d ) ) );
+                }
+            }else if( shift == 0 )
+            {
+                if( Rule::IsStore && halftoneWord == AllOnes )
+                {
+                    if( to > from )
+                        ::memmove( destBits->wordPtr( from ), sourceBits->wordPtr( s + first + 1 ), ( to - from ) * 2 );
+                }else
+                {
+                    int d = from;
+                    if( to > from )
+                        d += vectorWords( rule, destBits->wordPtr( from ), sourceBits->wordPtr( s + first + 1 ),
+                                          to - from, halftoneWord );
+                    for( ; d < to; d++ )
+                        destBits->setWord( d, rule.apply( halftoneWord & sourceBits->word( s + d - destBase ),
+                                                          destBits->word( d ) ) );
+                }
+                hi = 0;
+            }else
+            {
+                const int rshift = 16 - shift;
+                for( int d = from; d < to; d++ )
+                {
+                    const quint16 lo = sourceBits->word( s + d - destBase + 1 );
+                    destBits->setWord( d, rule.apply( halftoneWord & quint16( ( hi << shift ) | ( lo >> rshift ) ),
+                                                      destBits->word( d ) ) );
+                    hi = lo;
+                }
+            }
+
+            // last word, masked
+            src = halftoneWord;
+            if( withSource )
+            {
+                if( shift )
+                    src &= quint16( ( hi << shift ) | ( sourceWord( sourceBase, last + wordOff + 1 ) >> ( 16 - shift ) ) );
+                else
+                    src &= sourceWord( sourceBase, last + wordOff );
+            }
+            putWord( rule, destBase + last, src, lastMask );
+        }else
+        {
+            // only the same row of the same bitmap with the source left of the destination ends here;
+            // walk right to left so no source word is overwritten before it is read
+            quint16 lo = shift ? sourceWord( sourceBase, last + wordOff + 1 ) : 0;
+            for( int d = last; d >= first; d-- )
+            {
+                const quint16 hi = sourceWord( sourceBase, d + wordOff );
+                quint16 src = halftoneWord;
+                if( shift )
+                    src &= quint16( ( hi << shift ) | ( lo >> ( 16 - shift ) ) );
+                else
+                    src &= hi;
+                lo = hi;
+                quint16 mask = AllOnes;
+                if( d == first )
+                    mask &= firstMask;
+                if( d == last )
+                    mask &= lastMask;
+                putWord( rule, destBase + d, src, mask );
+            }
+        }
+    }
+}
+
+void BitBlt::referenceLoop()
 {
-#ifdef _USE_BB_IMP_
     quint16 prevWord, thisWord, skewWord, mergeMask,
             halftoneWord, mergeWord, word;
     for( int i = 1; i <= h; i++ )
@@ -978,32 +1380,106 @@ void BitBlt::copyLoop()
         sourceIndex = sourceIndex + sourceDelta;
         destIndex = destIndex + destDelta;
     }
-#else
+}
 
-    // qDebug() << "copyLoop destination" << dx << dy << w << h << ( sourceBits != 0 ? "source" : "" ) << ( halftoneBits != 0 ? "ht" : "" );
+void BitBlt::copyRows(int from, int to)
+{
+    // the rules the image uses most get their own instance of the word loop so the merge is
+    // inlined; the remaining rules go through the merge switch
+    switch( combinationRule )
+    {
+    case 0:
+        copyWords( RuleClear(), from, to );
+        break;
+    case 3:
+        copyWords( RuleStore(), from, to );
+        break;
+    case 4:
+        copyWords( RuleErase(), from, to );
+        break;
+    case 6:
+        copyWords( RuleReverse(), from, to );
+        break;
+    case 7:
+        copyWords( RuleUnder(), from, to );
+        break;
+    case 15:
+        copyWords( RuleSet(), from, to );
+        break;
+    default:
+        copyWords( AnyRule( combinationRule ), from, to );
+        break;
+    }
+}
+
+#ifdef ST_PARALLEL_BITBLT
+// each stripe gets at least this many destination words; below that the dispatch costs more than it saves
+static const int s_minWordsPerStripe = 4096;
+
+struct BitBlt::StripeTask : public QRunnable
+{
+    BitBlt* d_bb;
+    int d_from, d_to;
+    StripeTask( BitBlt* bb, int from, int to ):d_bb(bb),d_from(from),d_to(to) {}
+    void run() { d_bb->copyRows( d_from, d_to ); }
+};
 
-    // this code produces the same screen as the "Smalltalk 80 Virtual Image Version 2" handbook and
-    // doesn't seem to be slower than the above BB code
-    // has issues though with italic fonts
-    for( int y = 0; y < h; y++ )
+static QThreadPool* stripePool()
+{
+    static QThreadPool* pool = 0;
+    if( pool == 0 )
     {
-        for( int x = 0; x < w; x++ )
-        {
-            const quint16 dest = destBits->test(dx+x,dy+y);
-            if( sourceBits )
-            {
-                bool bit = merge( combinationRule, sourceBits->test(sx+x,sy+y), dest ) != 0;
-                destBits->set( dx+x, dy+y, bit );
-            }else
-            {
-                const bool halftone = halftoneBits != 0 ? halftoneBits->test( x & 15, y & 15 ) : AllOnes;
-                bool bit = merge( combinationRule, halftone, dest ) != 0;
-                destBits->set( dx+x, dy+y, bit );
-            }
-        }
+        // persistent, so each blit only pays for queuing the stripes
+        pool = new QThreadPool();
+        pool->setMaxThreadCount( QThread::idealThreadCount() - 1 );
     }
+    return pool;
+}
+#endif
 
+void BitBlt::copyLoop()
+{
+    destRaster = ( ( destBits->width() - 1 ) / 16 ) + 1;
+    sourceRaster = sourceBits != 0 ? ( ( sourceBits->width() - 1 ) / 16 ) + 1 : 0;
+
+    vDir = hDir = 1;
+    bool rowsIndependent = true;
+    if( sourceBits && sourceBits->isSameBuffer(*destBits) )
+    {
+        if( dy > sy )
+            vDir = -1;
+        else if( dy == sy && dx > sx )
+            hDir = -1;
+        // a row reading another row which is written in the same blit must wait for it
+        rowsIndependent = dy == sy || qAbs( dy - sy ) >= h;
+    }
+
+#ifdef ST_PARALLEL_BITBLT
+    const int words = ( ( ( dx + w - 1 ) >> 4 ) - ( dx >> 4 ) + 1 ) * h;
+    int stripes = qMin( words / s_minWordsPerStripe, int(h) );
+    if( rowsIndependent && stripes > 1 && QThread::idealThreadCount() > 1 )
+    {
+        QThreadPool* pool = stripePool();
+        stripes = qMin( stripes, pool->maxThreadCount() + 1 );
+        const int rows = ( h + stripes - 1 ) / stripes;
+        for( int from = rows; from < h; from += rows )
+            pool->start( new StripeTask( this, from, qMin( from + rows, int(h) ) ) );
+        copyRows( 0, qMin( rows, int(h) ) );
+        pool->waitForDone();
+        return;
+    }
+#else
+    Q_UNUSED(rowsIndependent);
 #endif
+    copyRows( 0, h );
+}
+
+quint16 BitBlt::sourceWord(int rowBase, int i) const
+{
+    // words left or right of the source row only ever end up in masked out bits
+    if( i < 0 || i >= sourceRaster || rowBase + i >= sourceBits->wordLen() )
+        return 0;
+    return sourceBits->word( rowBase + i );
 }
 
 quint16 BitBlt::merge(quint16 combinationRule, quint16 source, quint16 destination)
@@ -20,7 +20,9 @@
 * http://www.gnu.org/copyleft/gpl.html.
 */
 
+#include "StScreenRecorder.h"
 #include <QElapsedTimer>
+#include <string.h>
 #include <QFile>
 #include <QQueue>
 #include <QWidget>
@@ -53,6 +55,12 @@ public:
         Q_ASSERT( i < d_wordLen );
         d_buf[i] = v;
     }
+    // zero based and unchecked, used by the BitBlt inner loops
+    inline quint16 word( int i ) const { return d_buf[i]; }
+    inline void setWord( int i, quint16 v ) { d_buf[i] = v; }
+    inline void* wordPtr( int i ) { return d_buf + i; }
+    inline const void* wordPtr( int i ) const { return d_buf + i; }
+    static inline quint16 inMemory( quint16 v ) { return v; } // v as laid out in the buffer
 private:
     quint16 d_pixWidth, d_pixHeight, d_wordLen, d_wordWidth;
     quint16* d_buf;
@@ -79,6 +87,22 @@ private:
             return readU16( d_buf, i * 2 );
         }
         void wordAtPut( quint16 i, quint16 v );
+        // zero based and unchecked, used by the BitBlt inner loops
+        inline quint16 word( int i ) const { return readU16( d_buf, i * 2 ); }
+        inline void setWord( int i, quint16 v )
+        {
+            d_buf[i*2] = ( v >> 8 ) & 0xff;
+            d_buf[i*2+1] = v & 0xff;
+        }
+        inline void* wordPtr( int i ) { return d_buf + i * 2; }
+        inline const void* wordPtr( int i ) const { return d_buf + i * 2; }
+        static inline quint16 inMemory( quint16 v ) // v as laid out in the buffer
+        {
+            quint16 res;
+            const quint8 bytes[2] = { quint8( v >> 8 ), quint8( v & 0xff ) };
+            ::memcpy( &res, bytes, 2 );
+            return res;
+        }
         bool isNull() const { return d_buf == 0; }
         bool isSameBuffer( const Bitmap& rhs ) const { return rhs.d_buf == d_buf; }
         void toImage(QImage&, QRect = QRect()) const;
@@ -108,6 +132,7 @@ private:
             AbsoluteTime = 5, // followed by 2 words
         };
         enum { MaxPos = 0xfff }; // 12 bits
+        enum { DefaultFrameRate = 60, MinFrameRate = 30, MaxFrameRate = 120, MaxDamageRects = 32 };
 
         explicit Display(QWidget *parent = 0);
         ~Display();
@@ -126,13 +151,17 @@ private:
         quint16 nextEvent() { return d_events.dequeue(); }
         void clearEvents() { d_events.clear(); }
         quint32 getTicks() const { return d_elapsed.elapsed(); }
-        void drawRecord( int x, int y, int w, int h );
-        bool isRecOn() const { return d_recOn; }
+        bool startRecording( const QString& path );
+        void stopRecording();
+        bool isRecOn() const { return d_recorder.isOpen(); }
+        void recordArea( const QRect& ); // immediately, instead of with the next frame
         void updateArea(const QRect& r);
         void setLog(bool on);
         void setEventCallback( EventCallback cb ) { d_eventCb = cb; }
-        const QImage& getScreen() const { return d_screen; }
+        const QImage& getScreen();
+        void setFrameRate( int hz );
         static void processEvents();
+        static bool pollEvents(); // processEvents without the call counter; true once per frame
         static void copyToClipboard( const QByteArray& );
     signals:
         void sigEventQueue();
@@ -158,6 +187,7 @@ private:
         void keyReleaseEvent(QKeyEvent* event);
         void inputMethodEvent(QInputMethodEvent *);
         QString renderTitle() const;
+        void flushDamage();
         bool postEvent(EventType, quint16 param = 0 , bool withTime = true);
         bool keyEvent( int keyCode, char ch, bool down );
         void simulateKeyEvent( char ch );
@@ -172,17 +202,20 @@ private:
         QQueue<quint16> d_events;
         quint32 d_lastEvent; // number of milliseconds since last event was posted to queue
         QElapsedTimer d_elapsed;
-        QImage d_record;
+        ScreenRecorder d_recorder;
+        QString d_recordPath;
         EventCallback d_eventCb;
-        QRect d_updateArea;
-        bool d_shiftDown, d_capsLockDown, d_recOn, d_forceClose;
+        QList<QRect> d_damage; // coalesced screen damage, flushed once per frame
+        int d_frameTimer, d_msPerFrame;
+        bool d_shiftDown, d_capsLockDown, d_forceClose;
     };
 
     class BitBlt
     {
     public:
-        // This is a textbook implementation according to Blue Book chapter 18 "Simulation of BitBlt".
-        // Known to be inefficient; focus is on functionality and compliance.
+        // Clipping follows Blue Book chapter 18 "Simulation of BitBlt"; the copy loop works on whole
+        // 16 bit words with the source aligned by a two word shift register, specialised for the
+        // most used rules. The textbook implementation is kept as referenceCopyBits.
         struct Input
         {
             const Bitmap* sourceBits;
@@ -197,12 +230,22 @@ private:
         };
         BitBlt( const Input& );
         void copyBits();
+        void referenceCopyBits(); // Blue Book chapter 18 as is; see StBitBltBench
     protected:
         void clipRange();
         void computeMasks();
         void checkOverlap();
         void calculateOffsets();
         void copyLoop();
+        void referenceLoop();
+        inline quint16 sourceWord( int rowBase, int i ) const;
+        void copyRows( int from, int to );
+        template<class Rule>
+        void copyWords( const Rule&, int from, int to );
+        template<class Rule>
+        inline void putWord( const Rule&, int i, quint16 source, quint16 mask );
+        struct AnyRule;
+        struct StripeTask;
         static inline quint16 merge(quint16 combinationRule, quint16 source, quint16 destination );
     private:
         const Bitmap* sourceBits;
@@ -45,7 +45,7 @@ class ImageViewer::Model : public QAbstractItemModel
 public:
     explicit Model(QTreeView *parent = 0):QAbstractItemModel(parent)
     {
-        d_knowns.insert(65535,"objectMinusOne");
+        d_knowns.insert(ST_OBJECT_MEMORY::objectMinusOne,"objectMinusOne");
         d_knowns.insert(1,"objectZero");
         d_knowns.insert(3,"objectOne");
         d_knowns.insert(5,"objectTwo");
@@ -91,7 +91,7 @@ public:
         return static_cast<QTreeView*>(QObject::parent());
     }
 
-    void setOm( ST_OBJECT_MEMORY* om, quint16 root = 0 )
+    void setOm( ST_OBJECT_MEMORY* om, quint32 root = 0 )
     {
         beginResetModel();
         d_root = Slot();
@@ -110,7 +110,7 @@ public:
 
     ST_OBJECT_MEMORY* getOm() const { return d_om; }
 
-    quint16 getValue(const QModelIndex& index) const
+    quint32 getValue(const QModelIndex& index) const
     {
         if( !index.isValid() || d_om == 0 )
             return 0;
@@ -119,7 +119,7 @@ public:
         return s->d_oop;
     }
 
-    QModelIndex findValue( quint16 oop )
+    QModelIndex findValue( quint32 oop )
     {
         for( int i = 0; i < d_root.d_children.size(); i++ )
         {
@@ -178,7 +178,7 @@ public:
             case 1:
                 if( s->d_kind != Slot::Continuation && s->d_kind != Slot::Bytecode )
                 {
-                    const quint16 cls = d_om->fetchClassOf(s->d_oop);
+                    const quint32 cls = d_om->fetchClassOf(s->d_oop);
                     QByteArray str = d_knowns.value(cls);
                     if( !str.isEmpty() )
                         return str;
@@ -193,7 +193,7 @@ public:
         case Qt::ToolTipRole:
             if( s->d_kind != Slot::Continuation && s->d_kind != Slot::Bytecode )
             {
-                const quint16 cls = d_om->fetchClassOf(s->d_oop);
+                const quint32 cls = d_om->fetchClassOf(s->d_oop);
                 switch( index.column() )
                 {
                 case 0:
@@ -277,7 +277,7 @@ public:
         if( size == 0 )
             return false;
 
-        const quint16 cls = d_om->fetchClassOf(s->d_oop);
+        const quint32 cls = d_om->fetchClassOf(s->d_oop);
 
         return const_cast<Model*>(this)->fill(s, cls, size);
     }
@@ -292,7 +292,7 @@ public:
     struct Slot
     {
         enum Kind { Frame, Int, String, Character, Float, LargeInt, Chunk, Method, Continuation, Bytecode };
-        quint16 d_oop;
+        quint32 d_oop;
         quint8 d_kind;
         QList<Slot*> d_children;
         Slot* d_parent;
@@ -300,7 +300,7 @@ public:
         ~Slot() { foreach( Slot* s, d_children ) delete s; }
     };
 
-    void setKind( Slot* s, quint16 cls )
+    void setKind( Slot* s, quint32 cls )
     {
         switch( cls )
         {
@@ -397,7 +397,7 @@ public:
         return QString();
     }
 
-    bool fill(Slot* super, quint16 cls, quint16 size, bool all = false )
+    bool fill(Slot* super, quint32 cls, quint16 size, bool all = false )
     {
         if( cls == ST_OBJECT_MEMORY::classCompiledMethod )
         {
@@ -444,10 +444,10 @@ public:
     {
         if( d_om == 0 )
             return;
-        QList<quint16> oops = d_om->getAllValidOop();
-        foreach( quint16 oop, oops )
+        QList<ST_OBJECT_MEMORY::OOP> oops = d_om->getAllValidOop();
+        foreach( quint32 oop, oops )
         {
-            quint16 cls = d_om->fetchClassOf(oop);
+            quint32 cls = d_om->fetchClassOf(oop);
             if( cls == 0x38 || cls == 0x28 || cls == 0x0e || cls == 0x14 || cls == 0xcb0
                     || cls == 0x1a || cls == 0x1c )
                 continue; // no toplevel Symbol, String or Char, or Float, or Point, or Rectangle
@@ -467,7 +467,7 @@ public:
 
     Slot d_root;
     ST_OBJECT_MEMORY* d_om;
-    QHash<quint16,QByteArray> d_knowns;
+    QHash<quint32,QByteArray> d_knowns;
 };
 
 ImageViewer::ImageViewer(QWidget*p):QMainWindow(p),d_pushBackLock(false),d_nextStep(false)
@@ -513,6 +513,9 @@ ImageViewer::ImageViewer(QWidget*p):QMainWindow(p),d_pushBackLock(false),d_nextS
     new QShortcut( tr("CTRL+F"), this, SLOT(onFindText()));
     new QShortcut( tr("F3"), this, SLOT(onFindNext()));
     new QShortcut( tr("CTRL+SHIFT+C"), this, SLOT(onCopyTree()) );
+#ifdef ST_MEMORY_STATS
+    new QShortcut( tr("CTRL+M"), this, SLOT(onMemoryStats()) );
+#endif
 }
 
 bool ImageViewer::parse(const QString& path, bool collect)
@@ -594,7 +597,7 @@ void ImageViewer::createObjectTable()
     d_tree->setModel(d_mdl);
     dock->setWidget(d_tree);
     addDockWidget( Qt::LeftDockWidgetArea, dock );
-    connect( d_tree, SIGNAL(sigObject(quint16)), this, SLOT(onObject(quint16)) );
+    connect( d_tree, SIGNAL(sigObject(quint32)), this, SLOT(onObject(quint32)) );
 }
 
 void ImageViewer::createClasses()
@@ -615,13 +618,13 @@ void ImageViewer::createClasses()
 void ImageViewer::fillClasses()
 {
     d_classes->clear();
-    foreach( const quint16 cls, d_om->getClasses() )
+    foreach( const quint32 cls, d_om->getClasses() )
     {
         QTreeWidgetItem* item = new QTreeWidgetItem(d_classes);
         item->setText( 0, d_om->fetchClassName(cls) );
         item->setData( 0, Qt::UserRole, cls );
     }
-    foreach( const quint16 meta, d_om->getMetaClasses() )
+    foreach( const quint32 meta, d_om->getMetaClasses() )
     {
         QTreeWidgetItem* item = new QTreeWidgetItem(d_classes);
         item->setText( 0, d_om->fetchClassName(meta) );
@@ -656,21 +659,21 @@ void ImageViewer::createXref()
     connect( d_xref, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onXrefDblClicked(QTreeWidgetItem*,int)) );
 }
 
-void ImageViewer::fillXref(quint16 oop)
+void ImageViewer::fillXref(quint32 oop)
 {
     d_xref->clear();
-    const quint16 cls = d_om->fetchClassOf(oop);
+    const quint32 cls = d_om->fetchClassOf(oop);
     const QByteArray name = d_om->fetchClassName(cls);
     d_xrefTitle->setText( QString("oop %1 of <a href=\"oop:%2\">%3</a> is member of:").arg( oop, 0, 16 ).
                           arg( cls, 0, 16).arg(name.constData()) );
-    QList<quint16> refs = d_om->getXref().value(oop);
+    QList<ST_OBJECT_MEMORY::OOP> refs = d_om->getXref().value(oop);
     std::sort( refs.begin(), refs.end() );
     for( int i = 0; i < refs.size(); i++ )
     {
         QTreeWidgetItem* item = new QTreeWidgetItem( d_xref);
         item->setText(0,QString::number(refs[i],16) );
         item->setData(0,Qt::UserRole,refs[i]);
-        const quint16 cls = d_om->fetchClassOf(refs[i]);
+        const quint32 cls = d_om->fetchClassOf(refs[i]);
         item->setText( 1, d_om->fetchClassName(cls) );
         item->setData(1, Qt::UserRole, cls );
     }
@@ -702,14 +705,14 @@ void ImageViewer::createInsts()
     connect( d_insts, SIGNAL(itemDoubleClicked(QTreeWidgetItem*,int)), this, SLOT(onInstsDblClicked(QTreeWidgetItem*,int)) );
 }
 
-void ImageViewer::fillInsts(quint16 cls)
+void ImageViewer::fillInsts(quint32 cls)
 {
     d_insts->clear();
     d_instsTitle->setText(tr("(no class)"));
     if( d_om->getObjects().contains(cls) )
         return;
     const QByteArray name = d_om->fetchClassName(cls);
-    QList<quint16> objs = d_om->getAllValidOop();
+    QList<ST_OBJECT_MEMORY::OOP> objs = d_om->getAllValidOop();
     for( int i = 0; i < objs.size(); i++ )
     {
         if( d_om->fetchClassOf( objs[i] ) == cls )
@@ -721,7 +724,7 @@ void ImageViewer::fillInsts(quint16 cls)
                 item->setText( 1, d_om->fetchClassName(objs[i]) );
             else
             {
-                const quint16 cls = d_om->fetchClassOf(objs[i]);
+                const quint32 cls = d_om->fetchClassOf(objs[i]);
                 if( cls == ObjectMemory2::classAssociation )
                     item->setText(1, d_om->prettyValue(objs[i]));
                 else
@@ -759,7 +762,7 @@ void ImageViewer::closeEvent(QCloseEvent* event)
     emit sigClosing();
 }
 
-void ImageViewer::showDetail(quint16 oop)
+void ImageViewer::showDetail(quint32 oop)
 {
     d_detail->setHtml( detailText(oop) );
 }
@@ -787,7 +790,7 @@ void ImageViewer::createStack()
     connect( d_procs, SIGNAL(activated(int)), this, SLOT(onProcess(int)));
 }
 
-QString ImageViewer::detailText(quint16 oop)
+QString ImageViewer::detailText(quint32 oop)
 {
     if( !ST_OBJECT_MEMORY::isPointer(oop) )
         return QString("SmallInteger %1").arg( ST_OBJECT_MEMORY::integerValueOf(oop) );
@@ -799,9 +802,9 @@ QString ImageViewer::detailText(quint16 oop)
         return QString();
 }
 
-QString ImageViewer::objectDetailText(quint16 oop)
+QString ImageViewer::objectDetailText(quint32 oop)
 {
-    const quint16 cls = d_om->fetchClassOf(oop);
+    const quint32 cls = d_om->fetchClassOf(oop);
 
     if( cls == ST_OBJECT_MEMORY::classCompiledMethod )
         return methodDetailText(oop);
@@ -827,7 +830,7 @@ QString ImageViewer::objectDetailText(quint16 oop)
         for( int i = 0; i < fields.size(); i++ )
         {
             out << "<tr><td>" << i << " " << fields[i] << "</td> <td>";
-            quint16 val = d_om->fetchWordOfObject(i, oop);
+            quint32 val = d_om->fetchPointerOfObject(i, oop);
             out << prettyValue(val);
             out << "</td></tr>";
         }
@@ -843,7 +846,7 @@ QString ImageViewer::objectDetailText(quint16 oop)
             for( int i = fields.size(); i < len; i++ )
             {
                 out << "<tr><td>" << i << "</td> <td>";
-                quint16 val = d_om->fetchWordOfObject(i, oop);
+                quint32 val = d_om->fetchPointerOfObject(i, oop);
                 out << prettyValue(val);
                 out << "</td></tr>";
             }
@@ -858,22 +861,22 @@ QString ImageViewer::objectDetailText(quint16 oop)
     return html;
 }
 
-static bool lessThan( const QPair< QString, quint16 >& lhs, const QPair< QString, quint16 >& rhs )
+static bool lessThan( const QPair< QString, quint32 >& lhs, const QPair< QString, quint32 >& rhs )
 {
     return lhs.first.compare( rhs.first, Qt::CaseInsensitive ) < 0;
 }
 
-QString ImageViewer::classDetailText(quint16 cls)
+QString ImageViewer::classDetailText(quint32 cls)
 {
     QString html;
     QTextStream out(&html);
 
-    const quint16 clscls = d_om->fetchClassOf(cls);
+    const quint32 clscls = d_om->fetchClassOf(cls);
 
     out << "<html>";
     out << "<h2>" << d_om->fetchClassName(cls) << " " << QString::number(cls,16) << "</h2>";
     out << "<b>class:</b> <a href=\"oop:" << QString::number(clscls,16) << "\">" << d_om->fetchClassName(clscls) << "</a><br>";
-    const quint16 super = d_om->fetchPointerOfObject(0,cls);
+    const quint32 super = d_om->fetchPointerOfObject(0,cls);
     out << "<b>superclass:</b> <a href=\"oop:" << QString::number(super,16) << "\">" << d_om->fetchClassName(super) << "</a><br>";
 
     const quint16 spec = d_om->fetchWordOfObject(2,cls);
@@ -888,14 +891,14 @@ QString ImageViewer::classDetailText(quint16 cls)
     out << "<br>";
 
 #if 1
-    const quint16 vars = d_om->fetchPointerOfObject(4,cls);
+    const quint32 vars = d_om->fetchPointerOfObject(4,cls);
     if( vars != ST_OBJECT_MEMORY::objectNil )
     {
         out << "<h3>Fields</h3>";
         const quint16 len = d_om->fetchWordLenghtOf(vars);
         for( int i = 0; i < len; i++ )
         {
-            const quint16 str = d_om->fetchPointerOfObject(i,vars);
+            const quint32 str = d_om->fetchPointerOfObject(i,vars);
             out << d_om->fetchByteArray(str) << "<br>";
         }
     }
@@ -909,18 +912,18 @@ QString ImageViewer::classDetailText(quint16 cls)
     }
 #endif
 
-    const quint16 md = d_om->fetchPointerOfObject(1,cls);
-    const quint16 arr = d_om->fetchPointerOfObject(1,md);
+    const quint32 md = d_om->fetchPointerOfObject(1,cls);
+    const quint32 arr = d_om->fetchPointerOfObject(1,md);
     const int len = d_om->fetchWordLenghtOf(arr);
     Q_ASSERT( d_om->fetchWordLenghtOf(md) - 2 == len );
 
-    QList< QPair< QString, quint16 > > list;
+    QList< QPair< QString, quint32 > > list;
     for( int i = 0; i < len; i++ )
     {
-        const quint16 meth = d_om->fetchPointerOfObject(i,arr);
+        const quint32 meth = d_om->fetchPointerOfObject(i,arr);
         if( meth == ST_OBJECT_MEMORY::objectNil )
             continue;
-        const quint16 sym = d_om->fetchPointerOfObject(i+2,md);
+        const quint32 sym = d_om->fetchPointerOfObject(i+2,md);
         list << qMakePair( QString( d_om->fetchByteArray(sym) ), meth );
     }
     if( !list.isEmpty() )
@@ -939,14 +942,14 @@ QString ImageViewer::classDetailText(quint16 cls)
     return html;
 }
 
-QString ImageViewer::methodDetailText(quint16 oop)
+QString ImageViewer::methodDetailText(quint32 oop)
 {
     QString html;
     QTextStream out(&html);
 
     out << "<html>";
     out << "<h2>Method " << QString::number(oop,16) << "</h2>";
-    QPair<quint16,quint16> selCls = findSelectorAndClass(oop);
+    QPair<quint32,quint32> selCls = findSelectorAndClass(oop);
     if( selCls.second != 0 )
         out << "<b>defined in:</b> " << "<a href=\"oop:" + QByteArray::number(selCls.second,16) + "\">" +
                d_om->fetchClassName(selCls.second) + "</a><br>";
@@ -973,7 +976,7 @@ QString ImageViewer::methodDetailText(quint16 oop)
         for( int i = 0; i < len; i++ )
         {
             out << "<tr><td>" << i << "</td> <td>";
-            quint16 val = d_om->literalOfMethod(i, oop);
+            quint32 val = d_om->literalOfMethod(i, oop);
             out << prettyValue(val);
             out << "</td></tr>";
         }
@@ -1007,36 +1010,36 @@ QString ImageViewer::methodDetailText(quint16 oop)
     return html;
 }
 
-QByteArrayList ImageViewer::fieldList(quint16 cls, bool recursive)
+QByteArrayList ImageViewer::fieldList(quint32 cls, bool recursive)
 {
     QByteArrayList res;
     if( recursive )
     {
-        const quint16 super = d_om->fetchPointerOfObject(0,cls);
+        const quint32 super = d_om->fetchPointerOfObject(0,cls);
         if( super != ST_OBJECT_MEMORY::objectNil )
             res = fieldList(super,recursive);
     }
-    const quint16 vars = d_om->fetchPointerOfObject(4,cls);
+    const quint32 vars = d_om->fetchPointerOfObject(4,cls);
     if( vars != ST_OBJECT_MEMORY::objectNil )
     {
         const quint16 len = d_om->fetchWordLenghtOf(vars);
         for( int i = 0; i < len; i++ )
         {
-            const quint16 str = d_om->fetchPointerOfObject(i,vars);
+            const quint32 str = d_om->fetchPointerOfObject(i,vars);
             res << d_om->fetchByteArray(str);
         }
     }
     return res;
 }
 
-QString ImageViewer::prettyValue(quint16 val)
+QString ImageViewer::prettyValue(quint32 val)
 {
     return QString("<a href=\"oop:%2\">%3</a> %1").
             arg( QString::fromLatin1(d_om->prettyValue(val)).toHtmlEscaped() ).
             arg(val,0,16).arg(val,4,16,QChar('0'));
 
 #if 0
-    const quint16 cls = d_om->fetchClassOf(val);
+    const quint32 cls = d_om->fetchClassOf(val);
     switch( cls )
     {
     case ST_OBJECT_MEMORY::classSmallInteger:
@@ -1067,7 +1070,7 @@ QString ImageViewer::prettyValue(quint16 val)
 #endif
 }
 
-void ImageViewer::syncClasses(quint16 oop)
+void ImageViewer::syncClasses(quint32 oop)
 {
     for( int i = 0; i < d_classes->topLevelItemCount(); i++ )
     {
@@ -1081,7 +1084,7 @@ void ImageViewer::syncClasses(quint16 oop)
     }
 }
 
-void ImageViewer::syncObjects(quint16 oop)
+void ImageViewer::syncObjects(quint32 oop)
 {
     QModelIndex i = d_mdl->findValue( oop );
     if( i.isValid() )
@@ -1172,7 +1175,7 @@ QPair<QString, int> ImageViewer::bytecodeText(const quint8* bc, int pc)
     return qMakePair(QString(),1);
 }
 
-void ImageViewer::pushLocation(quint16 oop)
+void ImageViewer::pushLocation(quint32 oop)
 {
     if( d_pushBackLock )
         return;
@@ -1182,15 +1185,15 @@ void ImageViewer::pushLocation(quint16 oop)
     d_backHisto.push_back( oop );
 }
 
-QPair<quint16, quint16> ImageViewer::findSelectorAndClass(quint16 methodOop) const
+QPair<quint32, quint32> ImageViewer::findSelectorAndClass(quint32 methodOop) const
 {
-    quint16 sym = 0;
-    quint16 cls = 0;
-    foreach( quint16 arr, d_om->getXref().value(methodOop) )
+    quint32 sym = 0;
+    quint32 cls = 0;
+    foreach( quint32 arr, d_om->getXref().value(methodOop) )
     {
         if( d_om->fetchClassOf(arr) == ST_OBJECT_MEMORY::classArray )
         {
-            foreach( quint16 dict, d_om->getXref().value(arr) )
+            foreach( quint32 dict, d_om->getXref().value(arr) )
             {
                 if( d_om->fetchClassOf(dict) == ST_OBJECT_MEMORY::classMethodDictionary )
                 {
@@ -1206,7 +1209,7 @@ QPair<quint16, quint16> ImageViewer::findSelectorAndClass(quint16 methodOop) con
                     }
                     Q_ASSERT( found );
                     sym = d_om->fetchWordOfObject( i + 2, dict );
-                    foreach( quint16 cls, d_om->getXref().value(dict) )
+                    foreach( quint32 cls, d_om->getXref().value(dict) )
                     {
                         if( d_om->getClasses().contains(cls) || d_om->getMetaClasses().contains(cls) )
                             return qMakePair(sym,cls);
@@ -1246,7 +1249,7 @@ void ImageViewer::fillRegs(const Registers& regs)
     connect( r, SIGNAL(itemClicked(QTreeWidgetItem*,int)), this, SLOT(onRegsClicked(QTreeWidgetItem*,int)) );
 }
 
-void ImageViewer::syncAll(quint16 oop, QObject* cause, bool push)
+void ImageViewer::syncAll(quint32 oop, QObject* cause, bool push)
 {
     showDetail(oop);
     if( cause != d_classes )
@@ -1261,7 +1264,7 @@ void ImageViewer::syncAll(quint16 oop, QObject* cause, bool push)
         pushLocation(oop);
 }
 
-void ImageViewer::fillStack(quint16 activeContext)
+void ImageViewer::fillStack(quint32 activeContext)
 {
     d_stack->clear();
 
@@ -1269,16 +1272,16 @@ void ImageViewer::fillStack(quint16 activeContext)
         return;
 
     int level = 0;
-    const quint16 nil = ObjectMemory2::objectNil;
+    const quint32 nil = ObjectMemory2::objectNil;
     while( activeContext != nil )
     {
         QTreeWidgetItem* item = new QTreeWidgetItem(d_stack);
         item->setText(0, QString::number(level++) );
 
-        const quint16 sender = d_om->fetchPointerOfObject( 0, activeContext );
-        const quint16 pc = d_om->fetchPointerOfObject( 1, activeContext );
-        quint16 homeContext = activeContext;
-        quint16 method = d_om->fetchPointerOfObject( 3, activeContext );
+        const quint32 sender = d_om->fetchPointerOfObject( 0, activeContext );
+        const quint32 pc = d_om->fetchPointerOfObject( 1, activeContext );
+        quint32 homeContext = activeContext;
+        quint32 method = d_om->fetchPointerOfObject( 3, activeContext );
         if( d_om->isIntegerObject(method) )
         {
             // activeContext is a block context
@@ -1286,7 +1289,7 @@ void ImageViewer::fillStack(quint16 activeContext)
             method = d_om->fetchPointerOfObject( 3, homeContext );
         }
 
-        QPair<quint16,quint16> selCls = findSelectorAndClass(method);
+        QPair<quint32,quint32> selCls = findSelectorAndClass(method);
         QString methodName;
         if( selCls.first != 0 )
             methodName = d_om->fetchByteArray(selCls.first);
@@ -1297,7 +1300,7 @@ void ImageViewer::fillStack(quint16 activeContext)
 
         if( homeContext != activeContext )
         {
-            const quint16 homePc = d_om->fetchPointerOfObject(1,homeContext);
+            const quint32 homePc = d_om->fetchPointerOfObject(1,homeContext);
             // this is a block
             QString text1 = QString::number(activeContext,16);
             if( pc == nil )
@@ -1333,17 +1336,17 @@ void ImageViewer::fillStack(quint16 activeContext)
     }
 }
 
-void ImageViewer::fillProcs(quint16 activeContext)
+void ImageViewer::fillProcs(quint32 activeContext)
 {
     d_procs->clear();
 
-    const quint16 scheduler = d_om->fetchPointerOfObject(1, ObjectMemory2::processor ); // see Interpreter::firstContext()
-    const quint16 activeProcess = d_om->fetchPointerOfObject(1, scheduler );
+    const quint32 scheduler = d_om->fetchPointerOfObject(1, ObjectMemory2::processor ); // see Interpreter::firstContext()
+    const quint32 activeProcess = d_om->fetchPointerOfObject(1, scheduler );
     if( activeContext == 0 )
         activeContext = d_om->fetchPointerOfObject(1, activeProcess );
 
-    QMap<QString,quint16> sort;
-    QList<quint16> objs = d_om->getAllValidOop();
+    QMap<QString,quint32> sort;
+    QList<ST_OBJECT_MEMORY::OOP> objs = d_om->getAllValidOop();
     for( int i = 0; i < objs.size(); i++ )
     {
         if( d_om->fetchClassOf( objs[i] ) == ObjectMemory2::classProcess )
@@ -1353,7 +1356,7 @@ void ImageViewer::fillProcs(quint16 activeContext)
         }
     }
 
-    QMap<QString,quint16>::const_iterator i;
+    QMap<QString,quint32>::const_iterator i;
     for( i = sort.begin(); i != sort.end(); ++i )
     {
         const bool isActive = i.value() == activeProcess;
@@ -1368,7 +1371,7 @@ void ImageViewer::fillProcs(quint16 activeContext)
     fillStack( activeContext );
 }
 
-void ImageViewer::onObject(quint16 oop)
+void ImageViewer::onObject(quint32 oop)
 {
     if( QApplication::keyboardModifiers() == Qt::ControlModifier )
     {
@@ -1384,7 +1387,7 @@ void ImageViewer::onObject(quint16 oop)
         tv->expandToDepth(0);
         dock->setWidget(tv);
         addDockWidget( Qt::RightDockWidgetArea, dock );
-        connect( tv, SIGNAL(sigObject(quint16)), this, SLOT(onObject(quint16)) );
+        connect( tv, SIGNAL(sigObject(quint32)), this, SLOT(onObject(quint32)) );
     }else
     {
         syncAll(oop,d_tree,true);
@@ -1397,7 +1400,7 @@ void ImageViewer::onClassesClicked()
     if( item == 0 )
         return;
 
-    const quint16 oop = item->data(0,Qt::UserRole).toUInt();
+    const quint32 oop = item->data(0,Qt::UserRole).toUInt();
     syncAll(oop, d_classes, true );
 }
 
@@ -1406,7 +1409,7 @@ void ImageViewer::onLink(const QUrl& url)
     if( url.scheme() != "oop" )
         return;
     const QString str = url.path();
-    quint16 oop = str.toUInt(0,16);
+    quint32 oop = str.toUInt(0,16);
 
     if( QApplication::keyboardModifiers() == Qt::ControlModifier )
     {
@@ -1431,7 +1434,7 @@ void ImageViewer::onLink(const QString& link)
 {
     if( !link.startsWith( "oop:" ) )
         return;
-    quint16 oop = link.mid(4).toUInt(0,16);
+    quint32 oop = link.mid(4).toUInt(0,16);
     syncAll(oop);
 }
 
@@ -1443,7 +1446,7 @@ void ImageViewer::onGoBack()
     d_pushBackLock = true;
     d_forwardHisto.push_back( d_backHisto.last() );
     d_backHisto.pop_back();
-    const quint16 oop = d_backHisto.last();
+    const quint32 oop = d_backHisto.last();
     syncAll(oop,0,false);
 
     d_pushBackLock = false;
@@ -1453,14 +1456,14 @@ void ImageViewer::onGoForward()
 {
     if( d_forwardHisto.isEmpty() )
         return;
-    quint16 oop = d_forwardHisto.last();
+    quint32 oop = d_forwardHisto.last();
     d_forwardHisto.pop_back();
     syncAll(oop);
 }
 
 void ImageViewer::onXrefClicked(QTreeWidgetItem* item, int col)
 {
-    quint16 oop = item->data(col,Qt::UserRole).toUInt();
+    quint32 oop = item->data(col,Qt::UserRole).toUInt();
     if( oop == 0 )
         return;
     if( QApplication::keyboardModifiers() == Qt::ShiftModifier )
@@ -1471,7 +1474,7 @@ void ImageViewer::onXrefClicked(QTreeWidgetItem* item, int col)
 
 void ImageViewer::onInstsClicked(QTreeWidgetItem* item, int)
 {
-    quint16 oop = item->data(0,Qt::UserRole).toUInt();
+    quint32 oop = item->data(0,Qt::UserRole).toUInt();
 
     if( QApplication::keyboardModifiers() == Qt::ControlModifier )
     {
@@ -1487,7 +1490,7 @@ void ImageViewer::onInstsClicked(QTreeWidgetItem* item, int)
         tv->expandToDepth(0);
         dock->setWidget(tv);
         addDockWidget( Qt::RightDockWidgetArea, dock );
-        connect( tv, SIGNAL(sigObject(quint16)), this, SLOT(onObject(quint16)) );
+        connect( tv, SIGNAL(sigObject(quint32)), this, SLOT(onObject(quint32)) );
     }else if( QApplication::keyboardModifiers() == Qt::ShiftModifier )
         syncAll(oop);
     else
@@ -1496,7 +1499,7 @@ void ImageViewer::onInstsClicked(QTreeWidgetItem* item, int)
 
 void ImageViewer::onXrefDblClicked(QTreeWidgetItem* item, int col)
 {
-    quint16 oop = item->data(col,Qt::UserRole).toUInt();
+    quint32 oop = item->data(col,Qt::UserRole).toUInt();
     if( oop != 0 )
         syncAll(oop);
 }
@@ -1539,22 +1542,22 @@ void ImageViewer::onFindNext()
 
 void ImageViewer::onRegsClicked(QTreeWidgetItem* item, int)
 {
-    quint16 oop = item->data(1,Qt::UserRole).toUInt();
+    quint32 oop = item->data(1,Qt::UserRole).toUInt();
     if( oop )
         syncAll(oop);
 }
 
 void ImageViewer::onStackClicked(QTreeWidgetItem* item, int col)
 {
-    quint16 oop = item->data(col,Qt::UserRole).toUInt();
+    quint32 oop = item->data(col,Qt::UserRole).toUInt();
     if( oop != 0 )
         syncAll(oop);
 }
 
 void ImageViewer::onProcess(int i)
 {
-    const quint16 proc = d_procs->itemData(i).toUInt();
-    const quint16 context = d_om->fetchPointerOfObject(1, proc );
+    const quint32 proc = d_procs->itemData(i).toUInt();
+    const quint32 context = d_om->fetchPointerOfObject(1, proc );
     fillStack(context);
     syncAll(proc);
 }
@@ -1581,6 +1584,107 @@ void ImageViewer::onCopyTree()
     QApplication::clipboard()->setText(str);
 }
 
+#ifdef ST_MEMORY_STATS
+static bool moreAllocated( const QPair<quint64,quint32>& lhs, const QPair<quint64,quint32>& rhs )
+{
+    return lhs.first > rhs.first;
+}
+
+static bool moreSampled( const QPair<quint64,quint64>& lhs, const QPair<quint64,quint64>& rhs )
+{
+    return lhs.first > rhs.first;
+}
+#endif
+
+void ImageViewer::onMemoryStats()
+{
+#ifdef ST_MEMORY_STATS
+    const ObjectMemory2::Stats& s = d_om->getStats();
+    const double secs = qMax( qint64(1), s.d_since.elapsed() ) / 1000.0;
+
+    QString html;
+    QTextStream out(&html);
+
+    out << "<html>";
+    out << "<h2>Memory Statistics</h2>";
+    out << "<table border=1 cellspacing=0 cellpadding=3>";
+    out << "<tr><td>Allocations</td><td>" << s.d_allocations << " (" << qRound( s.d_allocations / secs ) << "/s)</td></tr>";
+    out << "<tr><td>Bytes allocated</td><td>" << s.d_allocatedBytes << "</td></tr>";
+    out << "<tr><td>Collections</td><td>" << s.d_collections << "</td></tr>";
+    out << "<tr><td>Mark / sweep time</td><td>" << s.d_markUs << " / " << s.d_sweepUs << " us</td></tr>";
+    out << "<tr><td>Max pause</td><td>" << s.d_maxPauseUs << " us</td></tr>";
+    out << "<tr><td>Last survivors / freed</td><td>" << s.d_lastSurvivors << " / " << s.d_lastFreed << "</td></tr>";
+    if( s.d_allocations != 0 )
+        out << "<tr><td>Min free slots</td><td>" << s.d_minFreeSlots << "</td></tr>";
+    out << "</table>";
+
+    out << "<h3>Pause Histogram</h3><table border=1 cellspacing=0 cellpadding=3>";
+    out << "<tr><th>Below</th><th>Count</th></tr>";
+    for( int i = 0; i < ObjectMemory2::Stats::PauseBuckets; i++ )
+    {
+        if( s.d_pauses[i] == 0 )
+            continue;
+        out << "<tr><td>";
+        if( i < ObjectMemory2::Stats::PauseBuckets - 1 )
+            out << ( quint64(1) << i ) << " us";
+        else
+            out << "longer";
+        out << "</td><td>" << s.d_pauses[i] << "</td></tr>";
+    }
+    out << "</table>";
+
+    QList< QPair<quint64,quint32> > list;
+    QHash<ObjectMemory2::OOP,ObjectMemory2::Stats::PerClass>::const_iterator i;
+    for( i = s.d_perClass.begin(); i != s.d_perClass.end(); ++i )
+        list << qMakePair( i.value().d_count, quint32(i.key()) );
+    std::sort( list.begin(), list.end(), moreAllocated );
+    out << "<h3>Allocations by Class</h3><table border=1 cellspacing=0 cellpadding=3>";
+    out << "<tr><th>Class</th><th>Count</th><th>Bytes</th><th>Per second</th></tr>";
+    for( int j = 0; j < list.size(); j++ )
+    {
+        const ObjectMemory2::Stats::PerClass& pc = s.d_perClass.value( list[j].second );
+        out << "<tr><td><a href=\"oop:" << QString::number(list[j].second,16) << "\">"
+            << d_om->fetchClassName(list[j].second) << "</a></td><td>" << pc.d_count << "</td><td>"
+            << pc.d_bytes << "</td><td>" << qRound( pc.d_count / secs ) << "</td></tr>";
+    }
+    out << "</table>";
+
+    if( d_om->getSampleInterval() != 0 )
+    {
+        QList< QPair<quint64,quint64> > sites;
+        QHash<quint64,ObjectMemory2::Stats::Site>::const_iterator k;
+        for( k = s.d_sites.begin(); k != s.d_sites.end(); ++k )
+            sites << qMakePair( quint64(k.value().d_samples), k.key() );
+        std::sort( sites.begin(), sites.end(), moreSampled );
+        out << "<h3>Allocation Sites</h3>";
+        out << "<p>one sample per " << d_om->getSampleInterval()
+            << ( d_om->isSamplingBytes() ? " bytes" : " allocations" ) << "</p>";
+        out << "<table border=1 cellspacing=0 cellpadding=3>";
+        out << "<tr><th>Method</th><th>PC</th><th>Selector</th><th>Samples</th><th>Creates</th></tr>";
+        for( int j = 0; j < sites.size() && j < 50; j++ )
+        {
+            const ObjectMemory2::Stats::Site& site = s.d_sites[ sites[j].second ];
+            out << "<tr><td><a href=\"oop:" << QString::number(site.d_method,16) << "\">"
+                << QString::fromLatin1( d_om->methodName( site.d_method, site.d_receiverClass ) ).toHtmlEscaped() << "</a></td><td>"
+                << site.d_pc << "</td><td>" << QString::fromLatin1( d_om->prettyValue( site.d_selector ) ).toHtmlEscaped() << "</td><td>"
+                << site.d_samples << "</td><td>";
+            QHash<ObjectMemory2::OOP,quint32>::const_iterator c;
+            for( c = site.d_classes.begin(); c != site.d_classes.end(); ++c )
+            {
+                if( c != site.d_classes.begin() )
+                    out << ", ";
+                out << d_om->fetchClassName(c.key()) << " " << c.value();
+            }
+            out << "</td></tr>";
+        }
+        out << "</table>";
+    }
+
+    out << "</html>";
+    d_detail->setHtml(html);
+#endif
+}
+
 ObjectTree::ObjectTree(QWidget* p)
 {
     setAlternatingRowColors(true);
@@ -1596,7 +1700,7 @@ void ObjectTree::setModel(ImageViewer::Model* m)
 
 void ObjectTree::onClicked(const QModelIndex& index)
 {
-    quint16 oop = d_mdl->getValue(index);
+    quint32 oop = d_mdl->getValue(index);
     if( index.column() == 1 )
         oop = d_mdl->d_om->fetchClassOf(oop);
 
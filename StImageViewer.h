@@ -40,7 +40,7 @@ namespace St
     public:
         ImageViewer(QWidget* = 0);
         bool parse( const QString& path, bool collect = false );
-        typedef QMap<QByteArray,quint16> Registers;
+        typedef QMap<QByteArray,quint32> Registers;
         void show(ST_OBJECT_MEMORY*, const Registers&);
         bool isNextStep() const { return d_nextStep; }
     signals:
@@ -55,30 +55,30 @@ namespace St
         void createClasses();
         void fillClasses();
         void createXref();
-        void fillXref(quint16);
+        void fillXref(quint32);
         void createInsts();
-        void fillInsts(quint16);
+        void fillInsts(quint32);
         void createDetail();
         void closeEvent(QCloseEvent* event);
-        void showDetail( quint16 );
+        void showDetail( quint32 );
         void createStack();
-        QString detailText( quint16 );
-        QString objectDetailText( quint16 );
-        QString classDetailText( quint16 );
-        QString methodDetailText( quint16 );
-        QByteArrayList fieldList( quint16 cls, bool recursive = true );
-        QString prettyValue(quint16);
-        void syncClasses(quint16);
-        void syncObjects(quint16);
+        QString detailText( quint32 );
+        QString objectDetailText( quint32 );
+        QString classDetailText( quint32 );
+        QString methodDetailText( quint32 );
+        QByteArrayList fieldList( quint32 cls, bool recursive = true );
+        QString prettyValue(quint32);
+        void syncClasses(quint32);
+        void syncObjects(quint32);
         static QPair<QString,int> bytecodeText(const quint8* , int pc);
-        void pushLocation(quint16);
-        QPair<quint16,quint16> findSelectorAndClass(quint16 methodOop) const;
+        void pushLocation(quint32);
+        QPair<quint32,quint32> findSelectorAndClass(quint32 methodOop) const;
         void fillRegs(const Registers&);
-        void syncAll(quint16, QObject* cause = 0, bool push = true );
-        void fillStack( quint16 activeContext );
-        void fillProcs(quint16 activeContext = 0);
+        void syncAll(quint32, QObject* cause = 0, bool push = true );
+        void fillStack( quint32 activeContext );
+        void fillProcs(quint32 activeContext = 0);
     protected slots:
-        void onObject( quint16 );
+        void onObject( quint32 );
         void onClassesClicked();
         void onLink(const QUrl& );
         void onLink( const QString& );
@@ -95,6 +95,7 @@ namespace St
         void onStackClicked(QTreeWidgetItem*,int);
         void onProcess(int);
         void onCopyTree();
+        void onMemoryStats();
     private:
         friend class ObjectTree;
         ST_OBJECT_MEMORY* d_om;
@@ -109,8 +110,8 @@ namespace St
         QLabel* d_xrefTitle;
         QLabel* d_instsTitle;
         QTextBrowser* d_detail;
-        QList<quint16> d_backHisto; // d_backHisto.last() is the current location
-        QList<quint16> d_forwardHisto;
+        QList<quint32> d_backHisto; // d_backHisto.last() is the current location
+        QList<quint32> d_forwardHisto;
         QString d_textToFind;
         bool d_pushBackLock, d_nextStep;
     };
@@ -122,7 +123,7 @@ namespace St
         ObjectTree(QWidget* p = 0);
         void setModel(ImageViewer::Model*);
     signals:
-        void sigObject( quint16 );
+        void sigObject( quint32 );
     protected slots:
         void onClicked(const QModelIndex&);
     private:
@@ -29,12 +29,14 @@ INCLUDEPATH += ..
 SOURCES +=\
     StImageViewer.cpp \
     StObjectMemory.cpp \
-    StObjectMemory2.cpp
+    StObjectMemory2.cpp \
+    StImageWriter.cpp
 
 HEADERS  += \
     StImageViewer.h \
     StObjectMemory.h \
-    StObjectMemory2.h
+    StObjectMemory2.h \
+    StImageWriter.h
 
 
 CONFIG(debug, debug|release) {
@@ -0,0 +1,96 @@
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StImageWriter.h"
+#include <QIODevice>
+#include <string.h>
+using namespace St;
+
+// Interchange format, see ObjectMemory::readFrom:
+// | u32 object space length in words | u32 object table length in words | 0x0000 | padding to 512 |
+// | object space, padded to the next 512 byte page plus one page |
+// | object table, one four byte entry per OOP |
+// Object space entry: | word length including the two header words | class | payload |
+// Object table entry: | count, unused | flags (0x80 odd, 0x40 pointers, 0x20 free), segment | word location |
+
+static const int s_pageLen = 512;
+
+
+ImageWriter::ImageWriter():d_error("")
+{
+    // all entries start as free
+    d_table.resize( MaxSlots * 4 );
+    for( int i = 0; i < d_table.size(); i += 4 )
+    {
+        d_table[i] = 0;
+        d_table[i+1] = 0x20;
+        d_table[i+2] = 0;
+        d_table[i+3] = 0;
+    }
+    d_space.reserve( 1 << 20 );
+}
+
+bool ImageWriter::addObject(quint16 oop, quint16 cls, const quint8* data, quint16 wordLen, bool isPtr, bool isOdd)
+{
+    if( oop & 1 || ( oop >> 1 ) >= MaxSlots )
+    {
+        d_error = "invalid oop";
+        return false;
+    }
+    if( wordLen > 0xffff - 2 )
+    {
+        d_error = "object too large";
+        return false;
+    }
+    const quint32 addr = d_space.size();
+    if( addr + ( wordLen + 2 ) * 2 > quint32(MaxSpaceBytes) )
+    {
+        d_error = "object space exceeds 16 segments";
+        return false;
+    }
+    d_space.resize( addr + ( wordLen + 2 ) * 2 );
+    quint8* to = (quint8*)d_space.data() + addr;
+    writeU16( to, 0, wordLen + 2 );
+    writeU16( to, 2, cls );
+    if( wordLen )
+        ::memcpy( to + 4, data, wordLen * 2 );
+
+    quint8* entry = (quint8*)d_table.data() + ( oop << 1 );
+    entry[0] = 0;
+    entry[1] = ( addr >> 17 ) | ( isPtr ? 0x40 : 0 ) | ( isOdd ? 0x80 : 0 );
+    writeU16( entry, 2, ( addr & 0x1ffff ) >> 1 );
+    return true;
+}
+
+bool ImageWriter::writeTo(QIODevice* out) const
+{
+    QByteArray header( s_pageLen, char(0) );
+    quint8* h = (quint8*)header.data();
+    const quint32 spaceWords = d_space.size() / 2;
+    const quint32 tableWords = d_table.size() / 2;
+    writeU16( h, 0, spaceWords >> 16 );
+    writeU16( h, 2, spaceWords & 0xffff );
+    writeU16( h, 4, tableWords >> 16 );
+    writeU16( h, 6, tableWords & 0xffff );
+    if( out->write( header ) != header.size() || out->write( d_space ) != d_space.size() )
+        return false;
+    const int numOfPages = d_space.size() / s_pageLen;
+    const QByteArray pad( ( numOfPages + 1 ) * s_pageLen - d_space.size(), char(0) );
+    return out->write( pad ) == pad.size() && out->write( d_table ) == d_table.size();
+}
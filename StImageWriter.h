@@ -0,0 +1,53 @@
+#ifndef ST_IMAGE_WRITER_H
+#define ST_IMAGE_WRITER_H
+
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include <QByteArray>
+
+class QIODevice;
+
+namespace St
+{
+    // Writes a Smalltalk-80 image in interchange format as read by ObjectMemory::readFrom.
+    // Objects are appended to the object space in the order they are added; the object table is
+    // kept in memory and written after the object space.
+    class ImageWriter
+    {
+    public:
+        enum { MaxSlots = 0xffff >> 1, MaxSpaceBytes = 16 << 17 }; // as ObjectMemory; 16 segments of 64k words
+        ImageWriter();
+        // data are the words of the object in big endian byte order, without the two header words
+        bool addObject( quint16 oop, quint16 cls, const quint8* data, quint16 wordLen, bool isPtr, bool isOdd );
+        bool writeTo( QIODevice* ) const;
+        const char* getError() const { return d_error; }
+        static inline void writeU16( quint8* data, int off, quint16 val )
+        {
+            data[off] = ( val >> 8 ) & 0xff;
+            data[off+1] = val & 0xff;
+        }
+    private:
+        QByteArray d_space;
+        QByteArray d_table;
+        const char* d_error;
+    };
+}
+
+#endif // ST_IMAGE_WRITER_H
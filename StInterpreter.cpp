@@ -25,6 +25,7 @@
 #include <QDateTime> 
 #include <QPainter>
 #include <QEventLoop>
+#include <QSaveFile>
 #include <QVBoxLayout>
 using namespace St;
 
@@ -119,6 +120,15 @@ void Interpreter::setOm(ObjectMemory2* om)
     connect( Display::inst(), SIGNAL(sigEventQueue()), this, SLOT(onEvent()) );
 }
 
+void Interpreter::allocationSite(OOP& method, qint16& pc, OOP& receiverClass, OOP& selector) const
+{
+    // primitive allocations run before the new method is activated, so these are the registers of the sender
+    method = memory->getRegister(Method);
+    pc = instructionPointer;
+    receiverClass = memory->fetchClassOf( memory->getRegister(Receiver) );
+    selector = memory->getRegister(MessageSelector);
+}
+
 void Interpreter::interpret()
 {
     cycleNr = 0;
@@ -984,7 +994,7 @@ void Interpreter::jump(qint32 offset)
 
 void Interpreter::jumpif(quint16 condition, qint32 offset)
 {
-    const quint16 boolean = popStack();
+    const OOP boolean = popStack();
     if( boolean == condition )
         jump(offset);
     else if( !( boolean == ObjectMemory2::objectTrue || boolean == ObjectMemory2::objectFalse ) )
@@ -1164,7 +1174,7 @@ Interpreter::OOP Interpreter::primitiveFail()
     return 0;
 }
 
-qint16 Interpreter::popInteger()
+Interpreter::SmallInt Interpreter::popInteger()
 {
     OOP integerPointer = popStack();
     successUpdate( memory->isIntegerObject(integerPointer) );
@@ -1174,7 +1184,7 @@ qint16 Interpreter::popInteger()
         return 0;
 }
 
-void Interpreter::pushInteger(qint16 integerValue)
+void Interpreter::pushInteger(SmallInt integerValue)
 {
     push( memory->integerObjectOf(integerValue));
 }
@@ -1194,7 +1204,16 @@ Interpreter::OOP Interpreter::positive16BitIntegerFor(quint16 integerValue)
 quint16 Interpreter::positive16BitValueOf(OOP integerPointer)
 {
     if( memory->isIntegerObject(integerPointer) )
+    {
+#ifdef ST_OOP32
+        const SmallInt value = memory->integerValueOf(integerPointer);
+        if( value < 0 || value > 0xffff )
+            return primitiveFail();
+        return value;
+#else
         return memory->integerValueOf(integerPointer);
+#endif
+    }
 
     if( memory->fetchClassOf(integerPointer) != ObjectMemory2::classLargePositiveInteger )
         return primitiveFail();
@@ -1352,11 +1371,11 @@ void Interpreter::primitiveMultiply()
 void Interpreter::primitiveDivide()
 {
     ST_TRACE_PRIMITIVE("");
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
     successUpdate( integerArgument != 0 );
     successUpdate( integerArgument != 0 && integerReceiver % integerArgument == 0 );
-    qint16 integerResult = 0;
+    SmallInt integerResult = 0;
     if( success )
     {
         integerResult = integerReceiver / integerArgument;
@@ -1380,10 +1399,10 @@ static int MOD(int a, int b) // Source: http://lists.inf.ethz.ch/pipermail/obero
 void Interpreter::primitiveMod()
 {
     ST_TRACE_PRIMITIVE("");
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
     successUpdate( integerArgument != 0 );
-    qint16 integerResult = 0;
+    SmallInt integerResult = 0;
     if( success )
     {
         integerResult = MOD(integerReceiver,integerArgument);
@@ -1422,10 +1441,10 @@ void Interpreter::primitiveMakePoint()
 void Interpreter::primitiveBitShift()
 {
     ST_TRACE_PRIMITIVE("");
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
 
-    qint16 integerResult = 0;
+    SmallInt integerResult = 0;
     if( success )
     {
         integerResult = ObjectMemory2::bitShift( integerReceiver, integerArgument );
@@ -1448,10 +1467,10 @@ static int DIV(int a, int b) // Source: http://lists.inf.ethz.ch/pipermail/obero
 void Interpreter::primitiveDiv()
 {
     ST_TRACE_PRIMITIVE("");
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
     successUpdate( integerArgument != 0 );
-    qint16 integerResult = 0;
+    SmallInt integerResult = 0;
     if( success )
     {
         integerResult = DIV( integerReceiver, integerArgument );
@@ -1475,7 +1494,7 @@ void Interpreter::primitiveBitOr()
     _bitImp('|');
 }
 
-qint16 Interpreter::fetchIntegerOfObject(quint16 fieldIndex, Interpreter::OOP objectPointer)
+Interpreter::SmallInt Interpreter::fetchIntegerOfObject(quint16 fieldIndex, Interpreter::OOP objectPointer)
 {
     OOP integerPointer = memory->fetchPointerOfObject(fieldIndex,objectPointer);
     if( memory->isIntegerObject(integerPointer) )
@@ -1739,9 +1758,7 @@ void Interpreter::dispatchInputOutputPrimitives()
         primitiveCopyBits();
         break;
     case 97:
-        //primitiveSnapshot();
-        qWarning() << "WARNING: primitiveSnapshot not yet implemented";
-        //primitiveFail();
+        primitiveSnapshot();
         break;
     case 98:
         primitiveTimeWordsInto();
@@ -1950,9 +1967,9 @@ void Interpreter::dispatchFloatPrimitives()
 
 void Interpreter::_addSubMulImp(char op)
 {
-    const int integerArgument = popInteger();
-    const int integerReceiver = popInteger();
-    int integerResult = 0;
+    const qint64 integerArgument = popInteger();
+    const qint64 integerReceiver = popInteger();
+    qint64 integerResult = 0;
     if( success )
     {
         switch(op)
@@ -2441,7 +2458,7 @@ void Interpreter::primitiveAsObject()
 {
     ST_TRACE_PRIMITIVE("");
     OOP thisReceiver = popStack();
-    OOP newOop = thisReceiver & 0xfffe;
+    OOP newOop = thisReceiver & OOP(~1);
     successUpdate( memory->hasObject( newOop ) ); // hasObject is not documented in BB
     if( success )
         push( newOop );
@@ -2482,7 +2499,7 @@ void Interpreter::primitiveNewMethod()
     const int literalCount = literalCountOfHeader(header);
     const int size = ( literalCount + 1 ) * 2 + bytecodeCount;
     OOP newMethod = memory->instantiateClassWithBytes(cls,size);
-    memory->storeWordOfObject(0, newMethod, header); // BB error: this line got obviously lost
+    memory->storePointerOfObject(0, newMethod, header); // BB error: this line got obviously lost
     for( int i = 0; i < literalCount; i++ )
         memory->storePointerOfObject(1 + i, newMethod, ObjectMemory2::objectNil );  // BB error, VIM fixed
     push( newMethod );
@@ -2750,6 +2767,62 @@ void Interpreter::primitiveQuit()
     // Display::inst()->close();
 }
 
+void Interpreter::primitiveSnapshot()
+{
+    ST_TRACE_PRIMITIVE("");
+    if( d_snapshotPath.isEmpty() )
+    {
+        primitiveFail();
+        return;
+    }
+    // The image computes justSnapped _ self snapshotPrimitive isNil; so the image is saved with
+    // false on the stack and continues with the startup code after a restart, while the running
+    // system gets nil and quits if requested.
+    const OOP receiver = popStack();
+    push( ObjectMemory2::objectFalse );
+    storeContextRegisters();
+    memory->storePointerOfObject( SuspendedContextIndex, activeProcess(), memory->getRegister(ActiveContext) );
+    memory->collectGarbage();
+
+    bool ok = false;
+    QSaveFile out(d_snapshotPath);
+    if( out.open(QIODevice::WriteOnly) && memory->writeTo(&out) && out.commit() )
+    {
+        ok = true;
+        qDebug() << "INFO: image saved to" << d_snapshotPath;
+    }else
+    {
+        out.cancelWriting();
+        qCritical() << "ERROR: cannot save image to" << d_snapshotPath;
+    }
+    if( ok && !d_nativeSnapshotPath.isEmpty() )
+    {
+        // written after the interchange image, so its timestamp marks it as up to date
+        QSaveFile snap(d_nativeSnapshotPath);
+        if( !snap.open(QIODevice::WriteOnly) || !memory->writeSnapshot(&snap) || !snap.commit() )
+        {
+            snap.cancelWriting();
+            qCritical() << "ERROR: cannot write snapshot" << d_nativeSnapshotPath;
+            ok = false;
+        }
+    }
+
+    popStack();
+    if( ok )
+        push( ObjectMemory2::objectNil );
+    else
+    {
+        push( receiver );
+        primitiveFail();
+    }
+}
+
+void Interpreter::setSnapshotPath(const QString& path, const QString& nativePath)
+{
+    d_snapshotPath = path;
+    d_nativeSnapshotPath = nativePath;
+}
+
 void Interpreter::createActualMessage()
 {
     OOP argumentArray = memory->instantiateClassWithPointers( ObjectMemory2::classArray, argumentCount );
@@ -2848,20 +2921,11 @@ void Interpreter::primitiveCopyBits()
 #ifdef ST_DO_SCREEN_RECORDING
     if( disp->isRecOn() && drawToDisp )
     {
-//        qDebug() << cycleNr << "updating screen" << in.destX << in.destY << in.width << in.height
-//                 << "clipped at" << in.clipX << in.clipY << in.clipWidth << in.clipHeight;
-        qDebug() << "copyBits" << in.destX << in.destY << in.width << in.height << in.combinationRule;
-        disp->drawRecord( in.destX, in.destY, in.width, in.height );
-        QImage img = destBits.toImage().convertToFormat(QImage::Format_RGB32);
-        if( true )
-        {
-            QPainter p(&img);
-            p.setPen(Qt::red);
-            p.drawRect(in.clipX, in.clipY, in.clipWidth, in.clipHeight);
-            p.setPen(Qt::green);
-            p.drawRect(in.destX, in.destY, in.width, in.height);
-        }
-        img.save(QString("step_%1.png").arg(cycleNr,8,10,QChar('0')));
+        // record each blit on its own instead of the damage collected per frame (which is then
+        // recorded again); replay with StScreenPlayer -each
+        const QRect dest(in.destX, in.destY, in.width, in.height);
+        const QRect clip( in.clipX, in.clipY, in.clipWidth, in.clipHeight );
+        disp->recordArea( dest & clip );
     }
 #endif
 }
@@ -3088,7 +3152,7 @@ void Interpreter::primitiveQuo()
     const double integerArgument = popInteger();
     const double integerReceiver = popInteger();
     successUpdate( integerArgument != 0 );
-    qint16 integerResult = 0;
+    SmallInt integerResult = 0;
     if( success )
     {
         integerResult = qRound( integerReceiver / integerArgument );
@@ -3108,8 +3172,8 @@ void Interpreter::primitiveBitXor()
 
 void Interpreter::_compareImp(char op)
 {
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
     if( success )
     {
         switch( op )
@@ -3139,9 +3203,9 @@ void Interpreter::_compareImp(char op)
 
 void Interpreter::_bitImp(char op)
 {
-    const qint16 integerArgument = popInteger();
-    const qint16 integerReceiver = popInteger();
-    qint16 integerResult = 0;
+    const SmallInt integerArgument = popInteger();
+    const SmallInt integerReceiver = popInteger();
+    SmallInt integerResult = 0;
     if( success )
     {
         switch( op )
@@ -3167,7 +3231,7 @@ void Interpreter::_bitImp(char op)
 void Interpreter::primitiveAsFloat()
 {
     ST_TRACE_PRIMITIVE("");
-    const qint16 integerReceiver = popInteger();
+    const SmallInt integerReceiver = popInteger();
     if( success )
         pushFloat(integerReceiver);
     else
@@ -35,11 +35,12 @@ namespace St
     // later code reviewed based on this version: http://www.mirandabanda.org/bluebook/
     //      and on the "Smalltalk-80 Virtual Image Version 2" (VIM) manual
 
-    class Interpreter : public QObject
+    class Interpreter : public QObject, public ObjectMemory2::SiteSource
     {
         Q_OBJECT
     public:
-        typedef quint16 OOP;
+        typedef ObjectMemory2::OOP OOP;
+        typedef ObjectMemory2::SmallInt SmallInt;
         enum MethodContext { SenderIndex = 0, // BB: The suspended context is called the new context's sender
                              InstructionPointerIndex = 1,
                              StackPointerIndex = 2, MethodIndex = 3, ReceiverIndex = 5,
@@ -99,6 +100,9 @@ namespace St
         Interpreter(QObject* p = 0);
         void setOm( ObjectMemory2* om );
         void interpret();
+        void allocationSite( OOP& method, qint16& pc, OOP& receiverClass, OOP& selector ) const;
+        // primitiveSnapshot writes the interchange image to path and, if not empty, a native snapshot to nativePath
+        void setSnapshotPath( const QString& path, const QString& nativePath = QString() );
     protected slots:
         void onEvent();
         void onTimeout();
@@ -181,8 +185,8 @@ namespace St
         void initPrimitive();
         void successUpdate( bool ); // original name success(value)
         OOP primitiveFail();
-        qint16 popInteger();
-        void pushInteger(qint16);
+        SmallInt popInteger();
+        void pushInteger(SmallInt);
         OOP positive16BitIntegerFor(quint16);
         quint16 positive16BitValueOf(OOP);
         void arithmeticSelectorPrimitive();
@@ -203,7 +207,7 @@ namespace St
         void primitiveDiv();
         void primitiveBitAnd();
         void primitiveBitOr();
-        qint16 fetchIntegerOfObject(quint16 fieldIndex, OOP objectPointer );
+        SmallInt fetchIntegerOfObject(quint16 fieldIndex, OOP objectPointer );
         void storeIntegerOfObjectWithValue(quint16 fieldIndex, OOP objectPointer, int integerValue );
         void primitiveEquivalent();
         void primitiveClass();
@@ -293,6 +297,7 @@ namespace St
         void resume(OOP aProcess);
         void suspendActive();
         void primitiveQuit();
+        void primitiveSnapshot();
         void createActualMessage();
         void sendMustBeBoolean();
         QByteArray prettyArgs_();
@@ -339,6 +344,7 @@ namespace St
         OOP toSignal;
         quint8 currentBytecode;
         bool success, newProcessWaiting;
+        QString d_snapshotPath, d_nativeSnapshotPath;
     };
 }
 
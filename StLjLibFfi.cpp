@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <QFile>
+#include <QSaveFile>
 #include <QDir>
 #include <QDateTime>
 #include "StDisplay.h"
@@ -39,6 +40,117 @@
 #endif
 
 static QDir s_imagePath;
+static QString s_imageFile;
+
+// Buffers of the files in Display::s_files, with the same index. Smalltalk reads and writes its files
+// page by page at the position set before, so the position is only tracked here; reads are served
+// from a read-ahead buffer and writes collected in a write-behind buffer, which is flushed before the
+// file itself is needed and at least once per frame, see St_pollEvents. A failing deferred write is
+// reported by the next read, write, truncate or close of the descriptor. Descriptors open on the same
+// file see each others writes, see syncSameFile. Files which can only be opened for reading, like a
+// write protected Smalltalk-80.sources, are memory mapped as a whole.
+enum { ReadAhead = 64 * 1024, WriteBehind = 64 * 1024 };
+
+struct FileBuffer
+{
+    qint64 pos; // of the next read or write
+    QByteArray read; // starts at readStart
+    qint64 readStart;
+    bool readAtEnd; // read reaches the end of the file
+    QByteArray write; // not yet written, starts at writeStart
+    qint64 writeStart;
+    const uchar* map;
+    qint64 mapSize;
+    bool readOnly;
+    bool writeFailed; // not yet reported
+    FileBuffer():pos(0),readStart(0),readAtEnd(false),writeStart(0),map(0),mapSize(0),
+        readOnly(false),writeFailed(false){}
+};
+
+static QVector<FileBuffer> s_buffers;
+static bool s_pendingWrites = false;
+
+static inline QFile* fileOf( int fd )
+{
+    if( fd >= 0 && fd < St::Display::s_files.size() && fd < s_buffers.size() )
+        return St::Display::s_files[fd];
+    return 0;
+}
+
+static bool openBuffered( QFile* f, FileBuffer& b )
+{
+    b = FileBuffer();
+    if( f->open(QIODevice::ReadWrite) )
+        return true;
+    if( !f->open(QIODevice::ReadOnly) )
+        return false;
+    b.readOnly = true;
+    b.mapSize = f->size();
+    if( b.mapSize > 0 )
+        b.map = f->map( 0, b.mapSize ); // if this fails the file is read through the buffer
+    return true;
+}
+
+static int addFile( QFile* f, const FileBuffer& b )
+{
+    St::Display::s_files.append( f );
+    s_buffers.resize( St::Display::s_files.size() );
+    s_buffers.last() = b;
+    return St::Display::s_files.size() - 1;
+}
+
+static bool flushWrites( int fd )
+{
+    FileBuffer& b = s_buffers[fd];
+    if( b.write.isEmpty() )
+        return true;
+    QFile* f = St::Display::s_files[fd];
+    const bool ok = f->seek( b.writeStart ) && f->write( b.write ) == b.write.size();
+    b.write.clear();
+    if( !ok )
+    {
+        b.writeFailed = true;
+        qWarning() << "ERROR: cannot write to" << f->fileName();
+    }
+    return ok;
+}
+
+static inline bool takeWriteFailure( FileBuffer& b )
+{
+    const bool failed = b.writeFailed;
+    b.writeFailed = false;
+    return failed;
+}
+
+static void syncSameFile( int fd, bool writing )
+{
+    // flush the writes of the other descriptors on the file, which also keeps the order of the writes;
+    // if fd is about to write, their read buffers would become stale
+    const QString name = St::Display::s_files[fd]->fileName();
+    for( int i = 0; i < s_buffers.size(); i++ )
+    {
+        if( i == fd || fileOf(i) == 0 || St::Display::s_files[i]->fileName() != name )
+            continue;
+        flushWrites( i );
+        if( writing )
+        {
+            s_buffers[i].read.clear();
+            s_buffers[i].readAtEnd = false;
+        }
+    }
+}
+
+static void flushAllWrites()
+{
+    if( !s_pendingWrites )
+        return;
+    for( int i = 0; i < s_buffers.size(); i++ )
+    {
+        if( fileOf(i) )
+            flushWrites( i );
+    }
+    s_pendingWrites = false;
+}
 
 extern "C"
 {
@@ -72,6 +184,61 @@ typedef struct{
     uint16_t data[];
 } WordArray;
 
+// Bodies of Smalltalk byte and word objects, see ObjectMemory.createArray. Blocks up to MaxPooled bytes
+// are carved from slabs and recycled per power of two size class when the Lua finalizer frees them,
+// so the frequent Strings and Floats neither hit malloc nor the LuaJIT GC heap. Only the Lua thread
+// allocates, so there is no locking; slabs are never given back.
+enum { MinClassShift = 4, ClassCount = 8, MaxPooled = 1 << ( MinClassShift + ClassCount - 1 ), SlabSize = 64 * 1024 };
+
+typedef struct{
+    int sizeClass; // -1 if the block comes from malloc
+    int reserved; // keeps the body 8 byte aligned
+} ArrayBlock;
+
+static void* s_freeBlocks[ClassCount];
+static char* s_slab = 0;
+static int s_slabLeft = 0;
+
+static void* allocArray( int bodyLen )
+{
+    const int len = bodyLen + sizeof(ArrayBlock);
+    ArrayBlock* b;
+    if( len > MaxPooled )
+    {
+        b = (ArrayBlock*)malloc( len );
+        if( b == 0 )
+            return 0;
+        b->sizeClass = -1;
+        return b + 1;
+    }
+    int c = 0;
+    while( ( 1 << ( c + MinClassShift ) ) < len )
+        c++;
+    if( s_freeBlocks[c] )
+    {
+        b = (ArrayBlock*)s_freeBlocks[c];
+        s_freeBlocks[c] = *(void**)b;
+    }else
+    {
+        const int size = 1 << ( c + MinClassShift );
+        if( size > s_slabLeft )
+        {
+            s_slab = (char*)malloc( SlabSize );
+            if( s_slab == 0 )
+            {
+                s_slabLeft = 0;
+                return 0;
+            }
+            s_slabLeft = SlabSize;
+        }
+        b = (ArrayBlock*)s_slab;
+        s_slab += size;
+        s_slabLeft -= size;
+    }
+    b->sizeClass = c;
+    return b + 1;
+}
+
 DllExport void St_initByteArray( ByteArray* ba, int byteLen, void* data )
 {
     assert( ba != 0 );
@@ -98,6 +265,50 @@ DllExport void St_initWordArray( WordArray* wa, int byteLen, void* data, int isB
     }
 }
 
+DllExport ByteArray* St_newByteArray( int byteLen, void* data )
+{
+    ByteArray* ba = (ByteArray*)allocArray( sizeof(ByteArray) + byteLen + 1 ); // one more for the zero
+    if( ba == 0 )
+        return 0;
+    ba->count = byteLen;
+    if( data )
+        memcpy( ba->data, data, byteLen );
+    else
+        memset( ba->data, 0, byteLen );
+    ba->data[byteLen] = 0;
+    return ba;
+}
+
+DllExport WordArray* St_newWordArray( int byteLen, void* data, int isBigEndian )
+{
+    WordArray* wa = (WordArray*)allocArray( sizeof(WordArray) + ( byteLen >> 1 ) * 2 );
+    if( wa == 0 )
+        return 0;
+    if( data )
+        St_initWordArray( wa, byteLen, data, isBigEndian );
+    else
+    {
+        wa->count = byteLen >> 1;
+        memset( wa->data, 0, wa->count * 2 );
+    }
+    return wa;
+}
+
+DllExport void St_freeArray( void* body )
+{
+    if( body == 0 )
+        return;
+    ArrayBlock* b = (ArrayBlock*)body - 1;
+    if( b->sizeClass < 0 )
+        free( b );
+    else
+    {
+        const int c = b->sizeClass;
+        *(void**)b = s_freeBlocks[c];
+        s_freeBlocks[c] = b;
+    }
+}
+
 DllExport int St_isRunning()
 {
     return St::Display::s_run;
@@ -105,24 +316,42 @@ DllExport int St_isRunning()
 
 static quint32 s_startTime = 0;
 
+// Flag word shared with Interpreter.lua, which reads it with a plain load on sends and backward jumps
+// instead of calling into C on every bytecode; only St_pollEvents and St_stop change it.
+enum { InputPending = 1, TimerDue = 2, CopyRequested = 4, Stopped = 8 };
+
+typedef struct{
+    int word;
+    int input; // number of input events since the last drain
+} EventFlags;
+
+static EventFlags s_flags = { 0, 0 };
+
+DllExport EventFlags* St_eventFlags()
+{
+    return &s_flags;
+}
+
 DllExport void St_stop()
 {
     St::Display::s_run = false;
+    s_flags.word |= Stopped;
+    flushAllWrites();
     const quint32 stopTime = St::Display::inst()->getTicks();
     qDebug() << "runtime [ms]:" << ( stopTime - s_startTime );
 }
 
-static int s_pendingEvents = 0;
-
 static void eventCallback()
 {
-    s_pendingEvents++;
+    s_flags.input++;
+    s_flags.word |= InputPending;
 }
 
 DllExport void St_start()
 {
     St::Display::s_run = true;
-    s_pendingEvents = 0;
+    s_flags.word = 0;
+    s_flags.input = 0;
     St::Display* d = St::Display::inst();
     s_startTime = d->getTicks();
     d->clearEvents();
@@ -193,6 +422,7 @@ DllExport int St_loadImage(const char* path )
 {
     St::LjObjectMemory om( Lua::Engine2::getInst() );
     s_imagePath = QFileInfo(path).absoluteDir();
+    s_imageFile = QFileInfo(path).absoluteFilePath();
     QFile in(path);
     if( !in.open(QIODevice::ReadOnly) )
     {
@@ -208,6 +438,24 @@ DllExport int St_loadImage(const char* path )
     return true;
 }
 
+DllExport int St_saveImage()
+{
+    // never overwrite the original image; saved images are written next to it and then overwritten
+    QString path = s_imageFile;
+    if( !path.endsWith(".saved.image") )
+        path = s_imagePath.absoluteFilePath( QFileInfo(path).completeBaseName() + ".saved.image" );
+    St::LjObjectMemory om( Lua::Engine2::getInst() );
+    QSaveFile out(path);
+    if( !out.open(QIODevice::WriteOnly) || !om.writeTo(&out) || !out.commit() )
+    {
+        out.cancelWriting();
+        qCritical() << "ERROR: cannot save image to" << path;
+        return false;
+    }
+    qDebug() << "INFO: image saved to" << path;
+    return true;
+}
+
 DllExport void St_log( const char* msg )
 {
     QFile out("st_log.txt");
@@ -237,6 +485,11 @@ DllExport void St_wakeupOn( ByteArray* ba )
     ba->data[0];
 }
 
+DllExport quint32 St_ticks()
+{
+    return St::Display::inst()->getTicks();
+}
+
 DllExport int St_itsTime()
 {
     if( s_wakeup == 0 )
@@ -250,18 +503,19 @@ DllExport int St_itsTime()
         return 0;
 }
 
-DllExport int St_pendingEvents()
+DllExport void St_pollEvents()
 {
+    if( St::Display::pollEvents() ) // delivers the input events via eventCallback
+        flushAllWrites();
     if( St_itsTime() )
-        return -1;
+        s_flags.word |= TimerDue;
     if( St::Display::s_copy )
     {
         St::Display::s_copy = false;
-        return -2;
+        s_flags.word |= CopyRequested;
     }
-    const int res = s_pendingEvents;
-    s_pendingEvents = 0;
-    return res;
+    if( !St::Display::s_run )
+        s_flags.word |= Stopped;
 }
 
 DllExport void St_beDisplay( WordArray* wa, int width, int height )
@@ -396,60 +650,142 @@ DllExport int St_openFile( ByteArray* ba )
     if( QFileInfo(name).isRelative() )
         name = s_imagePath.absoluteFilePath(name);
     f->setFileName(name);
-    if( !f->open(QIODevice::ReadWrite) )
+    FileBuffer b;
+    if( !openBuffered( f, b ) )
     {
         delete f;
         return -1;
     }
-    St::Display::s_files.append( f );
-    return St::Display::s_files.size() - 1;
+    return addFile( f, b );
 }
 
 DllExport int St_closeFile( int fd )
 {
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
+    if( QFile* f = fileOf(fd) )
     {
-        delete St::Display::s_files[fd];
+        flushWrites( fd );
+        const bool failed = takeWriteFailure( s_buffers[fd] );
+        s_buffers[fd] = FileBuffer();
+        delete f;
         St::Display::s_files[fd] = 0;
-        return 0;
+        return failed ? -1 : 0;
     }
     return -1;
 }
 
 DllExport int St_fileSize( int fd )
 {
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
-        return St::Display::s_files[fd]->size();
+    if( QFile* f = fileOf(fd) )
+    {
+        const FileBuffer& b = s_buffers[fd];
+        if( b.map )
+            return b.mapSize;
+        syncSameFile( fd, false );
+        return qMax( f->size(), b.writeStart + b.write.size() ); // without flushing the own pending writes
+    }
     return -1;
 }
 
 DllExport int St_seekFile( int fd, int pos )
 {
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
-        return St::Display::s_files[fd]->seek(pos) ? pos : -1;
+    if( fileOf(fd) && pos >= 0 )
+    {
+        s_buffers[fd].pos = pos;
+        return pos;
+    }
     return -1;
 }
 
 DllExport int St_readFile( int fd, ByteArray* ba )
 {
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
-        return St::Display::s_files[fd]->read((char*)ba->data,ba->count);
-    return -1;
+    QFile* f = fileOf(fd);
+    if( f == 0 )
+        return -1;
+    FileBuffer& b = s_buffers[fd];
+    const int len = ba->count;
+    if( b.map )
+    {
+        const int n = qBound<qint64>( 0, b.mapSize - b.pos, len );
+        memcpy( ba->data, b.map + b.pos, n );
+        b.pos += n;
+        return n;
+    }
+    syncSameFile( fd, false );
+    flushWrites( fd );
+    if( takeWriteFailure( b ) )
+        return -1;
+    const qint64 end = b.readStart + b.read.size();
+    if( b.pos < b.readStart || ( b.pos + len > end && !( b.readAtEnd && b.pos <= end ) ) )
+    {
+        if( !f->seek( b.pos ) )
+            return -1;
+        const int toRead = qMax( len, int(ReadAhead) );
+        b.readStart = b.pos;
+        b.read = f->read( toRead );
+        b.readAtEnd = b.read.size() < toRead;
+    }
+    const int n = qBound<qint64>( 0, b.readStart + b.read.size() - b.pos, len );
+    memcpy( ba->data, b.read.constData() + ( b.pos - b.readStart ), n );
+    b.pos += n;
+    return n;
 }
 
 DllExport int St_writeFile( int fd, ByteArray* ba, int toWrite )
 {
     if( ba->count < toWrite )
         return -1;
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
-        return St::Display::s_files[fd]->write((char*)ba->data,toWrite);
-    return -1;
+    if( fileOf(fd) == 0 || s_buffers[fd].readOnly )
+        return -1;
+    FileBuffer& b = s_buffers[fd];
+    b.read.clear();
+    b.readAtEnd = false;
+    syncSameFile( fd, true );
+    if( !b.write.isEmpty() && b.pos != b.writeStart + b.write.size() )
+        flushWrites( fd );
+    if( takeWriteFailure( b ) )
+        return -1;
+    if( b.write.isEmpty() )
+        b.writeStart = b.pos;
+    b.write.append( (const char*)ba->data, toWrite );
+    b.pos += toWrite;
+    s_pendingWrites = true;
+    if( b.write.size() >= WriteBehind && !flushWrites( fd ) )
+    {
+        b.writeFailed = false;
+        return -1;
+    }
+    return toWrite;
+}
+
+DllExport int St_readFileAt( int fd, int pos, ByteArray* ba )
+{
+    if( St_seekFile( fd, pos ) != pos )
+        return -1;
+    return St_readFile( fd, ba );
+}
+
+DllExport int St_writeFileAt( int fd, int pos, ByteArray* ba, int toWrite )
+{
+    if( St_seekFile( fd, pos ) != pos )
+        return -1;
+    return St_writeFile( fd, ba, toWrite );
 }
 
 DllExport int St_truncateFile( int fd, int size )
 {
-    if( fd < St::Display::s_files.size() && St::Display::s_files[fd] )
-        return St::Display::s_files[fd]->resize(size) ? 0 : -1;
+    if( QFile* f = fileOf(fd) )
+    {
+        FileBuffer& b = s_buffers[fd];
+        if( b.readOnly )
+            return -1;
+        flushWrites( fd );
+        if( takeWriteFailure( b ) )
+            return -1;
+        b.read.clear();
+        b.readAtEnd = false;
+        syncSameFile( fd, true );
+        return f->resize(size) ? 0 : -1;
+    }
     return -1;
 }
 
@@ -470,8 +806,7 @@ DllExport int St_createFile( ByteArray* ba )
         delete f;
         return -1;
     }
-    St::Display::s_files.append( f );
-    return St::Display::s_files.size() - 1;
+    return addFile( f, FileBuffer() );
 }
 
 DllExport int St_deleteFile( ByteArray* ba )
@@ -485,6 +820,7 @@ DllExport int St_deleteFile( ByteArray* ba )
     {
         if( St::Display::s_files[i] && St::Display::s_files[i]->fileName() == name )
         {
+            s_buffers[i] = FileBuffer(); // pending writes are void
             delete St::Display::s_files[i];
             St::Display::s_files[i] = 0;
         }
@@ -506,7 +842,8 @@ DllExport int St_renameFile( ByteArray* from, ByteArray* to )
     {
         if( St::Display::s_files[i] && St::Display::s_files[i]->fileName() == fromName )
         {
-            fdOff[i] = St::Display::s_files[i]->pos();
+            flushWrites( i );
+            fdOff[i] = s_buffers[i].pos;
             St::Display::s_files[i]->close();
         }
     }
@@ -520,10 +857,11 @@ DllExport int St_renameFile( ByteArray* from, ByteArray* to )
     {
         QFile* f = St::Display::s_files[j.key()];
         f->setFileName(toName);
-        if( !f->open(QIODevice::ReadWrite) )
+        FileBuffer& b = s_buffers[j.key()];
+        if( !openBuffered( f, b ) )
             qCritical() << "cannot reopen file" << toName;
         else
-            f->seek(j.value());
+            b.pos = j.value();
     }
     return res ? 0 : -1;
 }
@@ -19,8 +19,10 @@
 
 #include "StLjObjectMemory.h"
 #include "StObjectMemory.h"
+#include "StImageWriter.h"
 #include <QtDebug>
 #include <QIODevice>
+#include <QHash>
 #include <LjTools/Engine2.h>
 #include <lua.hpp>
 using namespace St;
@@ -89,6 +91,20 @@ static inline bool pushValue( lua_State* L, quint16 oop, const ObjectMemory& om
     return true;
 }
 
+enum ArrayKind { ByteDataArray, WordDataArray, BytecodeArray }; // see ObjectMemory.createArrays
+
+static inline void addArray( lua_State* L, int arrays, int& count, int obj, const ObjectMemory::ByteString& bs, ArrayKind kind )
+{
+    lua_pushvalue( L, obj );
+    lua_rawseti( L, arrays, ++count );
+    lua_pushlightuserdata( L, (void*)bs.d_bytes );
+    lua_rawseti( L, arrays, ++count );
+    lua_pushnumber( L, bs.d_byteLen );
+    lua_rawseti( L, arrays, ++count );
+    lua_pushnumber( L, kind );
+    lua_rawseti( L, arrays, ++count );
+}
+
 LjObjectMemory::LjObjectMemory(Lua::Engine2* lua, QObject *parent) : QObject(parent),
     d_lua(lua)
 {
@@ -110,10 +126,6 @@ bool LjObjectMemory::readFrom(QIODevice* in)
     Q_ASSERT( !lua_isnil( L, -1 ) );
     const int objectMemory = lua_gettop(L);
 
-    lua_getfield(L, objectMemory, "createArray" );
-    Q_ASSERT( !lua_isnil( L, -1 ) );
-    const int createArrayFunction = lua_gettop(L);
-
     lua_getfield(L, objectMemory, "allObjects" );
     Q_ASSERT( !lua_isnil( L, -1 ) );
     const int allObjects = lua_gettop(L);
@@ -122,10 +134,24 @@ bool LjObjectMemory::readFrom(QIODevice* in)
     Q_ASSERT( !lua_isnil( L, -1 ) );
     const int knownObjects = lua_gettop(L);
 
-    lua_createtable( L, 0, 0 );
+    // the field names are pushed once and set with rawset, instead of interning them for each object
+    pushKey( L, s_oop );
+    const int oopKey = lua_gettop(L);
+    pushKey( L, s_header );
+    const int headerKey = lua_gettop(L);
+    pushKey( L, s_count );
+    const int countKey = lua_gettop(L);
+
+    // the ByteArray/WordArray payloads are collected here and created by a single call to
+    // ObjectMemory.createArrays; four entries per object: object, raw data, byte length, kind
+    lua_createtable( L, oops.size(), 0 );
+    const int arrays = lua_gettop(L);
+    int arrayCount = 0;
+
+    lua_createtable( L, oops.size(), 0 );
     const int objectTable = lua_gettop(L);
 
-    // first create the lua values/tables for each valid objectTable entry
+    // first create the lua values/tables for each valid objectTable entry, sized for the fields set below
     for( int i = 0; i < oops.size(); i++ )
     {
         const quint16 oop = oops[i];
@@ -135,7 +161,19 @@ bool LjObjectMemory::readFrom(QIODevice* in)
 
         Q_ASSERT( ObjectMemory::isPointer(oop) );
 
-        lua_createtable( L, 0, 0 );
+        const quint16 cls = om.fetchClassOf(oop);
+        int arraySize = 0;
+        int hashSize = 2; // oop and count or data
+        if( cls == classCompiledMethod )
+        {
+            arraySize = om.literalCountOf(oop);
+            hashSize = 4; // oop, header, count and bytecode
+        }else if( cls == classFloat )
+            arraySize = 1;
+        else if( isPointers( instanceSpecificationOf(om,cls) ) )
+            arraySize = om.fetchWordLenghtOf(oop);
+
+        lua_createtable( L, arraySize, hashSize );
         lua_rawseti( L, objectTable, oopToLuaIndex(oop) );
         Q_ASSERT( lua_gettop(L) == objectTable );
     }
@@ -155,8 +193,9 @@ bool LjObjectMemory::readFrom(QIODevice* in)
         lua_rawgeti( L, objectTable, oopToLuaIndex(oop) );
         const int luaObject = lua_gettop(L);
 
+        lua_pushvalue( L, oopKey );
         lua_pushnumber( L, oop );
-        lua_setfield( L, luaObject, s_oop );
+        lua_rawset( L, luaObject );
 
         lua_rawgeti( L, objectTable, oopToLuaIndex(cls) );
         lua_setmetatable( L, luaObject );
@@ -173,14 +212,15 @@ bool LjObjectMemory::readFrom(QIODevice* in)
 
         if( cls == classCompiledMethod )
         {
-            pushKey( L, s_header );
+            lua_pushvalue( L, headerKey );
             quint16 header = om.fetchWordOfObject(0,oop);
             pushValue( L, header, om );
             lua_rawset( L, luaObject );
 
             const int count = om.literalCountOf(oop);
+            lua_pushvalue( L, countKey );
             lua_pushnumber( L, count );
-            lua_setfield( L, luaObject, s_count );
+            lua_rawset( L, luaObject );
             for( int j = 0; j < count; j++ )
             {
                 quint16 value = om.literalOfMethod(j,oop);
@@ -189,28 +229,22 @@ bool LjObjectMemory::readFrom(QIODevice* in)
                 lua_rawseti( L, luaObject, j );
             }
 
-            pushKey( L, s_bytecode );
             ObjectMemory::ByteString bs = om.methodBytecodes(oop);
-            lua_pushvalue( L, createArrayFunction );
-            lua_pushlightuserdata( L, (void*)bs.d_bytes );
-            lua_pushnumber( L, bs.d_byteLen );
-            lua_pushboolean( L, false );
-            if( lua_pcall(L, 3, 1, 0 ) == 0 )
-                lua_rawset( L, luaObject );
-            else
-                lua_pop(L,2); // key and error msg
+            addArray( L, arrays, arrayCount, luaObject, bs, BytecodeArray );
         }else if( cls == classFloat )
         {
             // Float is word and indexable
+            lua_pushvalue( L, countKey );
             lua_pushnumber( L, 1 );
-            lua_setfield( L, luaObject, s_count );
+            lua_rawset( L, luaObject );
             lua_pushnumber( L, om.fetchFloat(oop) );
             lua_rawseti( L, luaObject, 0 );
         }else if( isPointers(ispec) )
         {
             const int count = om.fetchWordLenghtOf(oop);
+            lua_pushvalue( L, countKey );
             lua_pushnumber( L, count );
-            lua_setfield( L, luaObject, s_count );
+            lua_rawset( L, luaObject );
             for( int j = 0; j < count; j++ )
             {
                 quint16 value = om.fetchPointerOfObject(j,oop);
@@ -221,23 +255,26 @@ bool LjObjectMemory::readFrom(QIODevice* in)
         }else
         {
             // ST object with no pointer members
-            const bool words = isWords(ispec);
-            pushKey( L, s_data );
             ObjectMemory::ByteString bs = om.fetchByteString(oop);
-            lua_pushvalue( L, createArrayFunction );
-            lua_pushlightuserdata( L, (void*)bs.d_bytes );
-            lua_pushnumber( L, bs.d_byteLen ); // byteLen
-            lua_pushboolean( L, words );
-            lua_pushboolean( L, om.isBigEndian() );
-            if( lua_pcall(L, 4, 1, 0 ) == 0 )
-                lua_rawset( L, luaObject );
-            else
-                lua_pop(L,2);
+            addArray( L, arrays, arrayCount, luaObject, bs, isWords(ispec) ? WordDataArray : ByteDataArray );
         }
         lua_pop(L,1); // luaObject
         Q_ASSERT( lua_gettop(L) == objectTable );
     }
 
+    // one protected call for all payloads; the raw data still belongs to om
+    lua_getfield(L, objectMemory, "createArrays" );
+    Q_ASSERT( !lua_isnil( L, -1 ) );
+    lua_pushvalue( L, arrays );
+    lua_pushnumber( L, arrayCount );
+    lua_pushboolean( L, om.isBigEndian() );
+    if( lua_pcall( L, 3, 0, 0 ) != 0 )
+    {
+        qCritical() << "ERROR: creating byte and word arrays:" << lua_tostring( L, -1 );
+        lua_settop( L, toptop );
+        return false;
+    }
+
     lua_pushnil(L);
     lua_rawgeti( L, objectTable, oopToLuaIndex(0x6480) ); // UndefinedObject
     Q_ASSERT( !lua_isnil( L, -1 ) );
@@ -269,9 +306,10 @@ bool LjObjectMemory::readFrom(QIODevice* in)
     lua_pop(L,1);
 
     lua_pop(L,1); // objectTable, no longer used
-    lua_pop(L,1); // allObjects
+    lua_pop(L,1); // arrays
+    lua_pop(L,3); // oop, header and count keys
     lua_pop(L,1); // knownObjects
-    lua_pop(L,1); // createArray
+    lua_pop(L,1); // allObjects
     lua_pop(L,1); // ObjectMemory
     Q_ASSERT( toptop == lua_gettop(L) );
 
@@ -279,3 +317,277 @@ bool LjObjectMemory::readFrom(QIODevice* in)
     return true;
 }
 
+
+static inline bool isTable( lua_State* L, int index )
+{
+    return lua_type( L, index ) == LUA_TTABLE;
+}
+
+static inline const int* arrayOf( lua_State* L, int index )
+{
+    // ByteArray and WordArray are pointer cdata, see ObjectMemory.createArray
+    const void* const* p = (const void* const*)lua_topointer( L, index );
+    return p ? (const int*)*p : 0;
+}
+
+static inline int countOf( lua_State* L, int obj )
+{
+    lua_getfield( L, obj, LjObjectMemory::s_count );
+    const int count = lua_tonumber( L, -1 );
+    lua_pop( L, 1 );
+    return count;
+}
+
+struct LjImageBuilder
+{
+    lua_State* L;
+    int d_list; // Lua array of all reachable objects, 1 based
+    int d_count;
+    QHash<const void*,quint16> d_oops;
+    int d_unencodable;
+
+    LjImageBuilder(lua_State* l):L(l),d_count(0),d_unencodable(0)
+    {
+        lua_createtable( L, 0x8000, 0 );
+        d_list = lua_gettop(L);
+    }
+    void visit( int index )
+    {
+        if( !isTable( L, index ) || d_oops.contains( lua_topointer( L, index ) ) )
+            return;
+        d_oops.insert( lua_topointer( L, index ), 0 );
+        lua_pushvalue( L, index );
+        lua_rawseti( L, d_list, ++d_count );
+    }
+    void visitFields( int obj, int count )
+    {
+        for( int j = 0; j < count; j++ )
+        {
+            lua_rawgeti( L, obj, j );
+            visit( -1 );
+            lua_pop( L, 1 );
+        }
+    }
+    bool assignOops()
+    {
+        // keep the oop of objects read from the image, so hashes and the well known oops stay the same
+        QSet<quint16> used;
+        used << LjObjectMemory::objectNil << LjObjectMemory::objectFalse << LjObjectMemory::objectTrue;
+        QList<int> pending;
+        for( int i = 1; i <= d_count; i++ )
+        {
+            lua_rawgeti( L, d_list, i );
+            lua_getfield( L, -1, LjObjectMemory::s_oop );
+            const quint16 oop = lua_isnil( L, -1 ) ? 0 : quint16( lua_tonumber( L, -1 ) );
+            lua_pop( L, 1 );
+            if( oop != 0 && !used.contains(oop) )
+            {
+                used.insert(oop);
+                d_oops[ lua_topointer( L, -1 ) ] = oop;
+            }else
+                pending << i;
+            lua_pop( L, 1 );
+        }
+        quint16 next = 2;
+        foreach( int i, pending )
+        {
+            while( used.contains(next) )
+                next += 2;
+            if( ( next >> 1 ) >= ImageWriter::MaxSlots )
+                return false;
+            used.insert(next);
+            lua_rawgeti( L, d_list, i );
+            d_oops[ lua_topointer( L, -1 ) ] = next;
+            lua_pop( L, 1 );
+        }
+        return true;
+    }
+    quint16 encode( int index )
+    {
+        switch( lua_type( L, index ) )
+        {
+        case LUA_TNIL:
+            return LjObjectMemory::objectNil;
+        case LUA_TBOOLEAN:
+            return lua_toboolean( L, index ) ? LjObjectMemory::objectTrue : LjObjectMemory::objectFalse;
+        case LUA_TNUMBER:
+            {
+                const double d = lua_tonumber( L, index );
+                const int i = d;
+                if( i == d && i >= -16384 && i <= 16383 ) // SmallInteger range
+                    return quint16( ( i << 1 ) | 1 );
+            }
+            break;
+        case LUA_TTABLE:
+            return d_oops.value( lua_topointer( L, index ) );
+        }
+        d_unencodable++;
+        return LjObjectMemory::objectNil;
+    }
+    quint16 classOf( int index )
+    {
+        quint16 cls = 0;
+        if( lua_getmetatable( L, index ) )
+        {
+            cls = encode( -1 );
+            lua_pop( L, 1 );
+        }
+        return cls;
+    }
+};
+
+bool LjObjectMemory::writeTo(QIODevice* out)
+{
+    lua_State* L = d_lua->getCtx();
+    const int toptop = lua_gettop(L);
+
+    lua_getglobal(L,"ObjectMemory");
+    lua_getfield(L, -1, "knownObjects" );
+    const int knownObjects = lua_gettop(L);
+
+    lua_pushnil( L );
+    if( !lua_getmetatable( L, -1 ) ) // UndefinedObject, see readFrom
+        lua_pushnil( L );
+    lua_remove( L, -2 );
+    const int undefinedObject = lua_gettop(L);
+    lua_getfield( L, knownObjects, "False" );
+    const int falseClass = lua_gettop(L);
+    lua_getfield( L, knownObjects, "True" );
+    const int trueClass = lua_gettop(L);
+
+    LjImageBuilder b(L);
+    b.visit( undefinedObject );
+    b.visit( falseClass );
+    b.visit( trueClass );
+    for( int oop = processor; oop <= classSymbol; oop += 2 )
+    {
+        lua_rawgeti( L, knownObjects, oop );
+        b.visit( -1 );
+        lua_pop( L, 1 );
+    }
+
+    // the list grows while it is scanned, i.e. a breadth first traversal
+    for( int i = 1; i <= b.d_count; i++ )
+    {
+        lua_rawgeti( L, b.d_list, i );
+        const int obj = lua_gettop(L);
+        if( lua_getmetatable( L, obj ) )
+        {
+            b.visit( -1 );
+            lua_pop( L, 1 );
+        }
+        lua_getfield( L, obj, s_data );
+        const bool hasData = !lua_isnil( L, -1 );
+        lua_pop( L, 1 );
+        if( !hasData )
+            b.visitFields( obj, countOf( L, obj ) ); // pointer fields or method literals; floats have a number only
+        lua_pop( L, 1 );
+    }
+
+    bool ok = b.assignOops();
+    if( !ok )
+        qCritical() << "ERROR: cannot save image, more objects than the object table can hold";
+
+    ImageWriter w;
+    QByteArray buf;
+    // nil, false and true are Lua values, but Smalltalk objects in the image
+    ok = ok && w.addObject( objectNil, b.encode( undefinedObject ), 0, 0, true, false );
+    ok = ok && w.addObject( objectFalse, b.encode( falseClass ), 0, 0, true, false );
+    ok = ok && w.addObject( objectTrue, b.encode( trueClass ), 0, 0, true, false );
+    for( int i = 1; ok && i <= b.d_count; i++ )
+    {
+        lua_rawgeti( L, b.d_list, i );
+        const int obj = lua_gettop(L);
+        const quint16 oop = b.encode( obj );
+        const quint16 cls = b.classOf( obj );
+        bool isPtr = false, isOdd = false;
+        buf.clear();
+        if( cls == classCompiledMethod )
+        {
+            lua_getfield( L, obj, s_header );
+            const quint16 header = b.encode( -1 );
+            lua_pop( L, 1 );
+            const int count = countOf( L, obj );
+            lua_getfield( L, obj, s_bytecode );
+            const int* bytecode = arrayOf( L, -1 ); // a ByteArray, i.e. count followed by the bytes
+            const int byteLen = bytecode ? *bytecode : 0;
+            lua_pop( L, 1 );
+            buf = QByteArray( ( 1 + count ) * 2 + byteLen + ( byteLen & 1 ), 0 );
+            quint8* data = (quint8*)buf.data();
+            ImageWriter::writeU16( data, 0, header );
+            for( int j = 0; j < count; j++ )
+            {
+                lua_rawgeti( L, obj, j );
+                ImageWriter::writeU16( data, ( j + 1 ) * 2, b.encode( -1 ) );
+                lua_pop( L, 1 );
+            }
+            if( byteLen )
+                ::memcpy( data + ( 1 + count ) * 2, bytecode + 1, byteLen );
+            isOdd = byteLen & 1;
+        }else if( cls == classFloat )
+        {
+            union { float f; quint32 w; };
+            lua_rawgeti( L, obj, 0 );
+            f = lua_tonumber( L, -1 );
+            lua_pop( L, 1 );
+            buf.resize( 4 );
+            ImageWriter::writeU16( (quint8*)buf.data(), 0, w >> 16 );
+            ImageWriter::writeU16( (quint8*)buf.data(), 2, w & 0xffff );
+        }else
+        {
+            lua_getfield( L, obj, s_data );
+            if( !lua_isnil( L, -1 ) )
+            {
+                // the instance specification of the class tells whether data is a ByteArray or a WordArray
+                lua_getmetatable( L, obj );
+                lua_rawgeti( L, -1, 2 ); // InstanceSpecIndex
+                const bool words = isWords( b.encode( -1 ) );
+                lua_pop( L, 2 );
+                const int* arr = arrayOf( L, -1 );
+                const int count = arr ? *arr : 0;
+                if( words )
+                {
+                    const quint16* from = (const quint16*)( arr + 1 );
+                    buf.resize( count * 2 );
+                    for( int j = 0; j < count; j++ )
+                        ImageWriter::writeU16( (quint8*)buf.data(), j * 2, from[j] );
+                }else
+                {
+                    buf = QByteArray( (const char*)( arr + 1 ), count );
+                    if( count & 1 )
+                    {
+                        buf.append( char(0) );
+                        isOdd = true;
+                    }
+                }
+            }else
+            {
+                const int count = countOf( L, obj );
+                buf.resize( count * 2 );
+                for( int j = 0; j < count; j++ )
+                {
+                    lua_rawgeti( L, obj, j );
+                    ImageWriter::writeU16( (quint8*)buf.data(), j * 2, b.encode( -1 ) );
+                    lua_pop( L, 1 );
+                }
+                isPtr = true;
+            }
+            lua_pop( L, 1 ); // data
+        }
+        lua_pop( L, 1 ); // obj
+        if( cls == 0 )
+        {
+            qCritical() << "ERROR: cannot save image, object without class" << QByteArray::number(oop,16).constData();
+            ok = false;
+        }else if( !w.addObject( oop, cls, (const quint8*)buf.constData(), buf.size() / 2, isPtr, isOdd ) )
+        {
+            qCritical() << "ERROR: cannot save image," << w.getError();
+            ok = false;
+        }
+    }
+    lua_settop( L, toptop );
+
+    if( b.d_unencodable )
+        qWarning() << "WARNING: saved" << b.d_unencodable << "non Smalltalk values as nil";
+    return ok && w.writeTo(out);
+}
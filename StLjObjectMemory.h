@@ -91,6 +91,7 @@ namespace St
 
         explicit LjObjectMemory(Lua::Engine2*, QObject *parent = 0);
         bool readFrom( QIODevice* );
+        bool writeTo( QIODevice* ); // interchange format of all objects reachable from knownObjects
 
     protected:
 
@@ -48,6 +48,16 @@ static int toaddress(lua_State * L)
     return 1;
 }
 
+static int loadresource(lua_State * L)
+{
+    QFile f( QString(":/%1").arg( luaL_checkstring(L,1) ) );
+    if( !f.open(QIODevice::ReadOnly) )
+        return 0;
+    const QByteArray data = f.readAll();
+    lua_pushlstring( L, data.constData(), data.size() );
+    return 1;
+}
+
 static int getfilesofdir(lua_State * L)
 {
     QString indir;
@@ -82,6 +92,35 @@ static int getfilesofdir(lua_State * L)
 #define ST_USE_MONITOR
 #endif
 
+#ifdef _WIN32
+#define DllExport __declspec(dllexport)
+#else
+#define DllExport
+#endif
+
+extern "C"
+{
+// samples since the interpreter last looked, see sampleMethod in Interpreter.lua
+typedef struct{
+    int samples;
+    int interpreted; // in vmstate 'I', i.e. not covered by a trace
+} ProfileProbe;
+
+static ProfileProbe s_probe = { 0, 0 };
+
+DllExport ProfileProbe* St_profileProbe()
+{
+    return &s_probe;
+}
+}
+
+static inline void probeSamples( int samples, int vmstate )
+{
+    s_probe.samples += samples;
+    if( vmstate == 'I' )
+        s_probe.interpreted += samples;
+}
+
 #ifdef ST_USE_MONITOR
 #ifdef ST_USE_MONITOR_GUI
 class JitMonitor : public QWidget
@@ -124,6 +163,7 @@ static void profile_callback(void *data, lua_State *L, int samples, int vmstate)
 {
     if( s_jitMonitor == 0 )
         s_jitMonitor = new JitMonitor();
+    probeSamples( samples, vmstate );
     switch( vmstate )
     {
     case 'N':
@@ -164,6 +204,7 @@ static void profile_callback(void *data, lua_State *L, int samples, int vmstate)
 {
     static quint32 compiled = 0, interpreted = 0, ccode = 0, gc = 0, compiler = 0, count = 1, lag = 0;
     count += samples;
+    probeSamples( samples, vmstate );
     switch( vmstate )
     {
     case 'N':
@@ -228,6 +269,9 @@ LjVirtualMachine::LjVirtualMachine(QObject* parent) : QObject(parent)
 
     lua_pushcfunction( d_lua->getCtx(), getfilesofdir );
     lua_setglobal( d_lua->getCtx(), "getfilesofdir" );
+
+    lua_pushcfunction( d_lua->getCtx(), loadresource );
+    lua_setglobal( d_lua->getCtx(), "loadresource" );
 }
 
 bool LjVirtualMachine::load(const QString& path)
@@ -238,7 +282,7 @@ bool LjVirtualMachine::load(const QString& path)
     return true;
 }
 
-void LjVirtualMachine::run(bool useJit, bool useProfiler)
+bool LjVirtualMachine::run(bool useJit, bool useProfiler, bool translate, bool jitLog)
 {
 #ifdef ST_USE_MONITOR
     if( useProfiler )
@@ -247,15 +291,50 @@ void LjVirtualMachine::run(bool useJit, bool useProfiler)
     if( !useJit )
         luaJIT_setmode( d_lua->getCtx(), 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF );
 
+    lua_pushboolean( d_lua->getCtx(), translate );
+    lua_setglobal( d_lua->getCtx(), "TranslateMethods" );
+    lua_pushboolean( d_lua->getCtx(), jitLog && useJit );
+    lua_setglobal( d_lua->getCtx(), "JitLog" );
+#ifdef ST_USE_MONITOR
+    lua_pushboolean( d_lua->getCtx(), useProfiler );
+    lua_setglobal( d_lua->getCtx(), "ProfileMethods" );
+#endif
+
     loadLuaLib( d_lua, "ObjectMemory");
+    loadLuaLib( d_lua, "Translator");
     loadLuaLib( d_lua, "Interpreter");
 
     lua_getglobal( d_lua->getCtx(), "runInterpreter" );
     if( !d_lua->runFunction() )
     {
         qCritical() << d_lua->getLastError().constData();
-        QMessageBox::critical( Display::inst(), tr("Lua Error"), d_lua->getLastError() );
+        return false;
+    }
+    return true;
+}
+
+bool LjVirtualMachine::setScript(const QString& path, int cycles)
+{
+    QFile in(path);
+    if( !in.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "ERROR: cannot open script" << path;
+        return false;
     }
+    const QByteArray script = in.readAll();
+    lua_pushlstring( d_lua->getCtx(), script.constData(), script.size() );
+    lua_setglobal( d_lua->getCtx(), "RunScript" );
+    lua_pushnumber( d_lua->getCtx(), cycles );
+    lua_setglobal( d_lua->getCtx(), "RunCycles" );
+    return true;
+}
+
+int LjVirtualMachine::getRunStatus() const
+{
+    lua_getglobal( d_lua->getCtx(), "RunStatus" );
+    const int res = lua_tointeger( d_lua->getCtx(), -1 );
+    lua_pop( d_lua->getCtx(), 1 );
+    return res;
 }
 
 void LjVirtualMachine::onNotify(int messageType, QByteArray val1, int val2)
@@ -275,6 +354,11 @@ void LjVirtualMachine::onNotify(int messageType, QByteArray val1, int val2)
 
 int main(int argc, char *argv[])
 {
+    for( int i = 1; i < argc; i++ )
+    {
+        if( QByteArray(argv[i]) == "-headless" )
+            qputenv( "QT_QPA_PLATFORM", "offscreen" ); // must be set before QApplication is created
+    }
     QApplication a(argc, argv);
     a.setOrganizationName("me@rochus-keller.ch");
     a.setOrganizationDomain("github.com/rochus-keller/Smalltalk");
@@ -287,6 +371,11 @@ int main(int argc, char *argv[])
     bool ide = false;
     bool useProfiler = false;
     bool useJit = true;
+    bool translate = false;
+    bool jitLog = false;
+    bool headless = false;
+    QString scriptPath;
+    int cycles = 0;
     const QStringList args = QCoreApplication::arguments();
     for( int i = 1; i < args.size(); i++ ) // arg 0 enthaelt Anwendungspfad
     {
@@ -300,7 +389,14 @@ int main(int argc, char *argv[])
             out << "  -ide      start Lua IDE" << endl;
             out << "  -pro file open given project in LuaIDE" << endl;
             out << "  -nojit    switch off JIT" << endl;
-            out << "  -stats    use LuaJIT profiler (if present)" << endl;
+            out << "  -stats    use LuaJIT profiler (if present), with a Smalltalk method profile" << endl;
+            out << "  -translate  translate hot methods to Lua functions" << endl;
+            out << "  -jitlog   report aborted JIT traces by reason, Lua function and method" << endl;
+            out << "  -headless run without a visible display (offscreen platform)" << endl;
+            out << "  -run file evaluate the Smalltalk expression in file, print result and time, then quit" << endl;
+            out << "  -cycles n give up if the -run expression has not finished after n cycles" << endl;
+            out << "  -fps n    screen refresh rate, 30 to 120 Hz" << endl;
+            out << "  -record file  log the changed screen areas to file" << endl;
             out << "  -h        display this information" << endl;
             return 0;
         }else if( args[i] == "-ide" )
@@ -309,7 +405,57 @@ int main(int argc, char *argv[])
                     useJit = false;
         else if( args[i] == "-stats" )
                     useProfiler = true;
-        else if( args[i] == "-pro" )
+        else if( args[i] == "-translate" )
+                    translate = true;
+        else if( args[i] == "-jitlog" )
+                    jitLog = true;
+        else if( args[i] == "-headless" )
+                    headless = true;
+        else if( args[i] == "-run" )
+        {
+            if( i+1 >= args.size() )
+            {
+                qCritical() << "error: invalid -run option" << endl;
+                return -1;
+            }else
+            {
+                scriptPath = args[i+1];
+                i++;
+            }
+        }else if( args[i] == "-cycles" )
+        {
+            if( i+1 >= args.size() )
+            {
+                qCritical() << "error: invalid -cycles option" << endl;
+                return -1;
+            }else
+            {
+                cycles = args[i+1].toInt();
+                i++;
+            }
+        }else if( args[i] == "-record" )
+        {
+            if( i+1 >= args.size() )
+            {
+                qCritical() << "error: invalid -record option" << endl;
+                return -1;
+            }else
+            {
+                St::Display::inst()->startRecording( args[i+1] );
+                i++;
+            }
+        }else if( args[i] == "-fps" )
+        {
+            if( i+1 >= args.size() )
+            {
+                qCritical() << "error: invalid -fps option" << endl;
+                return -1;
+            }else
+            {
+                St::Display::inst()->setFrameRate( args[i+1].toInt() );
+                i++;
+            }
+        }else if( args[i] == "-pro" )
         {
             ide = true;
             if( i+1 >= args.size() )
@@ -338,6 +484,11 @@ int main(int argc, char *argv[])
 
     LjVirtualMachine vm;
 
+    if( imagePath.isEmpty() && headless )
+    {
+        qCritical() << "error: -headless requires an image file" << endl;
+        return -1;
+    }
     if( imagePath.isEmpty() )
     {
         imagePath = QFileDialog::getOpenFileName(Display::inst(),LjVirtualMachine::tr("Open Smalltalk-80 Image File"),
@@ -347,6 +498,8 @@ int main(int argc, char *argv[])
     }
     if( !vm.load(imagePath) )
         return -1;
+    if( !scriptPath.isEmpty() && !vm.setScript(scriptPath, cycles) )
+        return -1;
 
     if( ide )
     {
@@ -354,12 +507,24 @@ int main(int argc, char *argv[])
         win.getProject()->addBuiltIn("toaddress");
         win.getProject()->addBuiltIn("getfilesofdir");
         win.getProject()->addBuiltIn("VirtualImage");
+        win.getProject()->addBuiltIn("TranslateMethods");
+        win.getProject()->addBuiltIn("ProfileMethods");
+        win.getProject()->addBuiltIn("JitLog");
+        win.getProject()->addBuiltIn("loadresource");
+        win.getProject()->addBuiltIn("RunScript");
+        win.getProject()->addBuiltIn("RunCycles");
+        win.getProject()->addBuiltIn("RunStatus");
         if( !proFile.isEmpty() )
             win.loadFile(proFile);
         a.exec();
     }else
     {
-        vm.run(useJit,useProfiler);
-        return 0;
+        if( !vm.run(useJit,useProfiler,translate,jitLog) )
+        {
+            if( !headless )
+                QMessageBox::critical( Display::inst(), LjVirtualMachine::tr("Lua Error"), vm.getLua()->getLastError() );
+            return -1;
+        }
+        return vm.getRunStatus();
     }
 }
@@ -35,7 +35,9 @@ namespace St
     public:
         explicit LjVirtualMachine(QObject *parent = 0);
         bool load( const QString& path );
-        void run(bool useJit = true, bool useProfiler = false);
+        bool run(bool useJit = true, bool useProfiler = false, bool translate = false, bool jitLog = false);
+        bool setScript( const QString& path, int cycles ); // evaluated once the image runs, see runScript
+        int getRunStatus() const; // 0 or 1 if the script failed
         Lua::Engine2* getLua() const { return d_lua; }
     protected slots:
         void onNotify( int messageType, QByteArray val1, int val2 );
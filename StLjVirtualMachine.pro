@@ -33,14 +33,18 @@ SOURCES += \
     StLjVirtualMachine.cpp \
     StLjObjectMemory.cpp \
     StDisplay.cpp \
+    StScreenRecorder.cpp \
     StObjectMemory.cpp \
+    StImageWriter.cpp \
     StLjLibFfi.cpp
 
 HEADERS  += \ 
     StLjVirtualMachine.h \
     StLjObjectMemory.h \
     StDisplay.h \
-    StObjectMemory.h
+    StScreenRecorder.h \
+    StObjectMemory.h \
+    StImageWriter.h
 
 DEFINES += LUAIDE_EMBEDDED
 include( ../LjTools/LuaIde.pri )
@@ -18,10 +18,22 @@
 */
 
 #include "StObjectMemory2.h"
+#include "StImageWriter.h"
 #include <QIODevice>
+#include <QFile>
 #include <QtDebug>
 #include <QtMath>
+#include <QThreadPool>
+#include <QThread>
+#include <QMutex>
+#include <QAtomicInt>
+#ifdef ST_MEMORY_STATS
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#endif
 #include <limits.h>
+#include <stddef.h>
 using namespace St;
 
 // According to "Smalltalk-80: Virtual Image Version 2", Xerox PARC, 1983
@@ -29,20 +41,47 @@ using namespace St;
 // and the Blue Book
 
 //#define _ST_COUNT_INSTS_
+#define ST_PARALLEL_GC
 
 #ifdef _ST_COUNT_INSTS_
 static QHash<ObjectMemory2::OOP,int> s_countByClass;
+#undef ST_PARALLEL_GC // s_countByClass is not thread safe
 #endif
 
-ObjectMemory2::ObjectMemory2(QObject* p):QObject(p)
+// each worker gets at least this many object table slots; below that the threads cost more than they save
+static const int s_minSlotsPerWorker = 4096;
+// a mark stack with more entries than this publishes half of them so idle workers can steal them
+static const int s_markStackShare = 64;
+
+ObjectMemory2::ObjectMemory2(QObject* p):QObject(p),d_refsValid(false),d_pool(0),d_workers(1),d_snapshot(0)
 {
+#ifdef ST_MEMORY_STATS
+    d_siteSource = 0;
+    d_sampleInterval = 0;
+    d_sampleCountdown = 0;
+    d_sampleBytes = false;
+#endif
+    setupWorkers();
+}
 
+void ObjectMemory2::setupWorkers()
+{
+#ifdef ST_PARALLEL_GC
+    d_workers = qMax( 1, qMin( QThread::idealThreadCount(), d_ot.d_slots.size() / s_minSlotsPerWorker ) );
+    if( d_workers > 1 )
+    {
+        if( d_pool == 0 )
+            d_pool = new QThreadPool(this);
+        // all workers must run at the same time, otherwise the mark termination protocol blocks
+        d_pool->setMaxThreadCount( d_workers );
+    }
+#endif
 }
 
 static inline bool isFree(quint8 flags ) { return flags & 0x20; }
 static inline bool isPtr(quint8 flags ) { return flags & 0x40; }
 static inline bool isOdd(quint8 flags ) { return flags & 0x80; }
-static inline bool isInt(quint16 ptr ) { return ptr & 1; }
+static inline bool isInt(quint32 ptr ) { return ptr & 1; }
 
 static quint32 readU32( QIODevice* in )
 {
@@ -90,11 +129,8 @@ bool ObjectMemory2::readFrom(QIODevice* in)
     if( nineTen.size() != 2 || nineTen[0] != 0x0 || nineTen[1] != 0x0 )
         return false; // not in interchange format
 
-    in->seek( in->size() - 10 );
-    const QByteArray last = in->read(10);
-    if( last.size() != 10 || last[3] != 0x20 || last[6] != 0x01 ||
-            quint8(last[7]) != 0x43 || quint8(last[8]) != 0xf3 || quint8(last[9]) != 0x3b )
-        return false;
+    // The last ten bytes are not checked; they are the final object table entries of the original
+    // Xerox image and differ in images written by writeTo; the lengths are checked below instead.
 
     in->seek( 512 );
 
@@ -142,22 +178,261 @@ bool ObjectMemory2::readFrom(QIODevice* in)
         OtSlot* slot = d_ot.allocate( slotNr, byteLen, cls, isPtr(flags) );
         Q_ASSERT( slot != 0 );
         slot->d_isOdd = isOdd(flags);
+#ifdef ST_OOP32
+        const quint8* data = (const quint8*)objectSpace.constData() + addr + 4;
+        if( slot->d_isPtr )
+        {
+            for( int j = 0; j < wordLen; j++ )
+                slot->oops()[j] = widen( readU16( data, j * 2 ) );
+        }else
+        {
+            ::memcpy( slot->d_obj->d_data, data, byteLen );
+            if( slot->d_hasFrame )
+            {
+                const int count = getLiteralByteCount( data ) / 2 + 1; // header and literals
+                for( int j = 0; j < count && j < wordLen; j++ )
+                    slot->oops()[j] = widen( readU16( data, j * 2 ) );
+            }
+        }
+#else
         ::memcpy( slot->d_obj->d_data, objectSpace.constData() + addr + 4, byteLen ); // without header
+#endif
     }
 
-    updateRefs();
+    d_refsValid = false;
+    collectFreeSlots();
+    buildInstances();
 
     return true;
 }
 
-QList<quint16> ObjectMemory2::getAllValidOop() const
+bool ObjectMemory2::writeTo(QIODevice* out) const
+{
+    ImageWriter w;
+#ifdef ST_OOP32
+    QByteArray buf;
+#endif
+    for( int i = 0; i < d_ot.d_slots.size(); i++ )
+    {
+        const OtSlot& s = d_ot.d_slots[i];
+        if( s.isFree() )
+            continue;
+        const quint8* data = s.d_obj->d_data;
+#ifdef ST_OOP32
+        if( s.d_isPtr || s.d_hasFrame )
+        {
+            // narrow the native fields to the 16 bit interchange layout
+            if( s.d_isPtr )
+                buf = QByteArray( s.d_size * 2, 0 );
+            else
+                buf = QByteArray( (const char*)data, s.d_size * 2 );
+            const int count = s.d_isPtr ? s.d_size : qMin( getLiteralByteCount( data ) / 2 + 1, int(s.d_size) );
+            for( int j = 0; j < count; j++ )
+            {
+                const OOP oop = s.oops()[j];
+                if( widen( quint16(oop) ) != oop )
+                {
+                    qCritical() << "ERROR: cannot write image, oop" << QByteArray::number(oop,16).constData()
+                                << "does not fit in 16 bits";
+                    return false;
+                }
+                ImageWriter::writeU16( (quint8*)buf.data(), j * 2, oop );
+            }
+            data = (const quint8*)buf.constData();
+        }
+#endif
+        if( !w.addObject( i << 1, s.getClass(), data, s.d_size, s.d_isPtr, s.d_isOdd ) )
+        {
+            qCritical() << "ERROR: cannot write image," << w.getError();
+            return false;
+        }
+    }
+    return w.writeTo(out);
+}
+
+// Native snapshot format, all numbers in host byte order:
+// | SnapshotHeader |
+// | SnapshotSlot * slotCount |
+// | padding to 8 bytes |
+// | object space; each object as in memory (Object header and data), 8 byte aligned |
+// The layout depends on the build (ST_OOP32, Object header size), so the header records it and a mismatch
+// makes the VM fall back to the interchange format.
+
+static const char s_snapshotMagic[8] = { 'S', 't', '8', '0', 'S', 'n', 'a', 'p' };
+static const quint32 s_byteOrderMark = 0x01020304;
+static const quint16 s_snapshotVersion = 1;
+
+struct SnapshotHeader
+{
+    char d_magic[8];
+    quint32 d_byteOrder;
+    quint16 d_version;
+    quint8 d_oopSize;
+    quint8 d_objectHeader;
+    quint32 d_slotCount;
+    quint32 d_reserved;
+    quint64 d_spaceLen;
+};
+
+struct SnapshotSlot
+{
+    enum Flags { Used = 1, Odd = 2, Ptr = 4, Frame = 8 };
+    quint64 d_offset; // from the start of the object space
+    quint32 d_class;  // slot index as in OtSlot
+    quint16 d_size;
+    quint8 d_flags;
+    quint8 d_unused;
+};
+
+static inline quint64 align8( quint64 len )
+{
+    return ( len + 7 ) & ~quint64(7);
+}
+
+bool ObjectMemory2::isSnapshot(QIODevice* in)
+{
+    const QByteArray magic = in->peek( sizeof(s_snapshotMagic) );
+    return magic.size() == sizeof(s_snapshotMagic) && ::memcmp( magic.constData(), s_snapshotMagic, magic.size() ) == 0;
+}
+
+bool ObjectMemory2::mapSnapshot(const QString& path)
+{
+    QFile* file = new QFile(path,this);
+    if( !file->open(QIODevice::ReadOnly) || file->size() < qint64(sizeof(SnapshotHeader)) )
+    {
+        delete file;
+        return false;
+    }
+    // private mapping, so the GC and the interpreter can write to the objects without touching the file
+    uchar* base = file->map( 0, file->size(), QFileDevice::MapPrivateOption );
+    if( base == 0 )
+    {
+        delete file;
+        return false;
+    }
+    const SnapshotHeader* h = (const SnapshotHeader*)base;
+    const quint64 spaceOff = align8( sizeof(SnapshotHeader) + quint64(h->d_slotCount) * sizeof(SnapshotSlot) );
+    if( ::memcmp( h->d_magic, s_snapshotMagic, sizeof(s_snapshotMagic) ) != 0 ||
+            h->d_byteOrder != s_byteOrderMark || h->d_version != s_snapshotVersion ||
+            h->d_oopSize != sizeof(OOP) || h->d_objectHeader != offsetof(Object,d_data) ||
+            spaceOff + h->d_spaceLen > quint64(file->size()) ||
+#ifdef ST_OOP32
+            h->d_slotCount < quint32(d_ot.d_slots.size()) )
+#else
+            h->d_slotCount != quint32(d_ot.d_slots.size()) )
+#endif
+    {
+        delete file;
+        return false;
+    }
+
+    const SnapshotSlot* entries = (const SnapshotSlot*)( base + sizeof(SnapshotHeader) );
+    quint8* space = base + spaceOff;
+    QVector<OtSlot> table( h->d_slotCount );
+    for( quint32 i = 0; i < h->d_slotCount; i++ )
+    {
+        const SnapshotSlot& from = entries[i];
+        if( ( from.d_flags & SnapshotSlot::Used ) == 0 )
+            continue;
+        OtSlot& to = table[i];
+        to.d_size = from.d_size;
+        to.d_class = from.d_class;
+        to.d_isOdd = ( from.d_flags & SnapshotSlot::Odd ) != 0;
+        to.d_isPtr = ( from.d_flags & SnapshotSlot::Ptr ) != 0;
+        to.d_hasFrame = ( from.d_flags & SnapshotSlot::Frame ) != 0;
+        if( from.d_offset + sizeof(Object) + to.dataLen() > h->d_spaceLen )
+        {
+            qCritical() << "ERROR: corrupt snapshot" << path;
+            delete file;
+            return false;
+        }
+        to.d_obj = (Object*)( space + from.d_offset );
+    }
+    d_ot.d_slots = table;
+    d_ot.d_mapped = space;
+    d_ot.d_mappedLen = h->d_spaceLen;
+    delete d_snapshot;
+    d_snapshot = file; // keeps the mapping alive
+    setupWorkers();
+
+    d_refsValid = false;
+    collectFreeSlots();
+    buildInstances();
+
+    return true;
+}
+
+bool ObjectMemory2::writeSnapshot(QIODevice* out) const
+{
+    const int slotCount = d_ot.d_slots.size();
+    QVector<SnapshotSlot> entries( slotCount );
+    quint64 spaceLen = 0;
+    for( int i = 0; i < slotCount; i++ )
+    {
+        const OtSlot& from = d_ot.d_slots[i];
+        SnapshotSlot& to = entries[i];
+        ::memset( &to, 0, sizeof(SnapshotSlot) );
+        if( from.isFree() )
+            continue;
+        to.d_offset = spaceLen;
+        to.d_class = from.d_class;
+        to.d_size = from.d_size;
+        to.d_flags = SnapshotSlot::Used | ( from.d_isOdd ? SnapshotSlot::Odd : 0 ) |
+                ( from.d_isPtr ? SnapshotSlot::Ptr : 0 ) | ( from.d_hasFrame ? SnapshotSlot::Frame : 0 );
+        spaceLen += align8( sizeof(Object) + from.dataLen() );
+    }
+
+    SnapshotHeader h;
+    ::memset( &h, 0, sizeof(SnapshotHeader) );
+    ::memcpy( h.d_magic, s_snapshotMagic, sizeof(s_snapshotMagic) );
+    h.d_byteOrder = s_byteOrderMark;
+    h.d_version = s_snapshotVersion;
+    h.d_oopSize = sizeof(OOP);
+    h.d_objectHeader = offsetof(Object,d_data);
+    h.d_slotCount = slotCount;
+    h.d_spaceLen = spaceLen;
+
+    const char zeros[8] = { 0 };
+    const quint64 tableLen = quint64(slotCount) * sizeof(SnapshotSlot);
+    if( out->write( (const char*)&h, sizeof(SnapshotHeader) ) != sizeof(SnapshotHeader) ||
+            out->write( (const char*)entries.constData(), tableLen ) != qint64(tableLen) )
+        return false;
+    const int pad = align8( sizeof(SnapshotHeader) + tableLen ) - ( sizeof(SnapshotHeader) + tableLen );
+    if( out->write( zeros, pad ) != pad )
+        return false;
+    for( int i = 0; i < slotCount; i++ )
+    {
+        const OtSlot& s = d_ot.d_slots[i];
+        if( s.isFree() )
+            continue;
+        const qint64 len = sizeof(Object) + s.dataLen(); // includes the terminating 0 allocate() appends
+        if( out->write( (const char*)s.d_obj, len ) != len )
+            return false;
+        const int pad = align8(len) - len;
+        if( out->write( zeros, pad ) != pad )
+            return false;
+    }
+    return true;
+}
+
+void ObjectMemory2::collectFreeSlots()
+{
+    d_freeSlots.clear();
+    for( int i = 1; i < d_ot.d_slots.size(); i++ )
+    {
+        if( d_ot.d_slots[i].isFree() )
+            d_freeSlots.enqueue(i);
+    }
+}
+
+QList<ObjectMemory2::OOP> ObjectMemory2::getAllValidOop() const
 {
-    QList<quint16> res;
+    QList<OOP> res;
     for( int i = 0; i < d_ot.d_slots.size(); i++ )
     {
         if( d_ot.d_slots[i].isFree() )
             continue;
-        const quint16 oop = ( i << 1 );
+        const OOP oop = ( i << 1 );
         res << oop;
     }
     return res;
@@ -172,7 +447,7 @@ int ObjectMemory2::getOopsLeft() const
     return count;
 }
 
-void ObjectMemory2::setRegister(quint8 index, quint16 value)
+void ObjectMemory2::setRegister(quint8 index, OOP value)
 {
     if( index >= d_registers.size() )
         d_registers.resize( d_registers.size() + 10 );
@@ -191,6 +466,29 @@ void ObjectMemory2::removeTemp(ObjectMemory2::OOP oop)
 
 ObjectMemory2::OOP ObjectMemory2::getNextInstance(ObjectMemory2::OOP cls, ObjectMemory2::OOP cur) const
 {
+#ifdef ST_INSTANCE_INDEX
+    if( ( cls >> 1 ) >= quint32(d_instances.size()) )
+        return 0;
+    const QVector<quint64>& bits = d_instances[cls >> 1];
+    quint32 i = cur ? ( cur >> 1 ) + 1 : 0;
+    int w = i >> 6;
+    if( w >= bits.size() )
+        return 0;
+    quint64 word = bits[w] >> ( i & 63 );
+    while( word == 0 )
+    {
+        if( ++w >= bits.size() )
+            return 0;
+        word = bits[w];
+        i = w << 6;
+    }
+    while( ( word & 1 ) == 0 )
+    {
+        word >>= 1;
+        i++;
+    }
+    return i << 1;
+#else
     int start = 0;
     if( cur )
         start = ( cur >> 1 ) + 1;
@@ -202,6 +500,43 @@ ObjectMemory2::OOP ObjectMemory2::getNextInstance(ObjectMemory2::OOP cls, Object
             return i << 1;
     }
     return 0;
+#endif
+}
+
+#ifdef ST_INSTANCE_INDEX
+// Each class has a bitmap over the object table slots, indexed by the slot of the class; setting and
+// clearing a bit is all an allocation or a free costs, and the bitmaps are never released.
+
+void ObjectMemory2::addInstance(OOP cls, OOP oop)
+{
+    QVector<quint64>& bits = d_instances[cls >> 1];
+    const quint32 i = oop >> 1;
+    if( bits.size() <= int( i >> 6 ) )
+        bits.resize( ( d_ot.d_slots.size() + 63 ) >> 6 ); // first instance, or the object table grew
+    bits[i >> 6] |= quint64(1) << ( i & 63 );
+}
+
+void ObjectMemory2::removeInstance(OOP cls, OOP oop)
+{
+    QVector<quint64>& bits = d_instances[cls >> 1];
+    const quint32 i = oop >> 1;
+    if( int( i >> 6 ) < bits.size() )
+        bits[i >> 6] &= ~( quint64(1) << ( i & 63 ) );
+}
+#endif
+
+void ObjectMemory2::buildInstances()
+{
+#ifdef ST_INSTANCE_INDEX
+    d_instances.clear();
+    d_instances.resize( d_ot.d_slots.size() );
+    for( int i = 0; i < d_ot.d_slots.size(); i++ )
+    {
+        const OtSlot& s = d_ot.d_slots[i];
+        if( !s.isFree() )
+            addInstance( s.getClass(), i << 1 );
+    }
+#endif
 }
 
 QByteArray ObjectMemory2::prettyValue(ObjectMemory2::OOP oop) const
@@ -305,6 +640,10 @@ quint16 ObjectMemory2::fetchWordOfObject(quint16 fieldIndex, OOP objectPointer)
 //        qWarning() << "WARNING: accessing pointer or byte object by word"; // with recent fixes never happened so far
 
     Q_ASSERT( fieldIndex < s.d_size );
+#ifdef ST_OOP32
+    if( s.d_isPtr )
+        return s.oops()[fieldIndex]; // the low 16 bits of a SmallInteger are the same as in the 16 bit format
+#endif
     return readU16( s.d_obj->d_data, off );
 }
 
@@ -313,6 +652,15 @@ void ObjectMemory2::storeWordOfObject(quint16 fieldIndex, OOP objectPointer, qui
     const OtSlot& s = getSlot(objectPointer);
     const quint32 off = fieldIndex * 2;
     Q_ASSERT( fieldIndex < s.d_size );
+#ifdef ST_OOP32
+    if( s.d_isPtr )
+    {
+        s.oops()[fieldIndex] = widen(withValue);
+        return;
+    }
+    if( s.d_hasFrame )
+        s.oops()[fieldIndex] = widen(withValue);
+#endif
     writeU16( s.d_obj->d_data, off, withValue );
 }
 
@@ -448,9 +796,21 @@ void ObjectMemory2::swapPointersOf(OOP firstPointer, OOP secondPointer)
     const quint32 i1 = firstPointer >> 1;
     const quint32 i2 = secondPointer >> 1;
     Q_ASSERT( i1 < d_ot.d_slots.size() && i2 < d_ot.d_slots.size() );
+    const OOP cls1 = d_ot.d_slots[i1].getClass();
+    const OOP cls2 = d_ot.d_slots[i2].getClass();
     OtSlot tmp =  d_ot.d_slots[i1];
     d_ot.d_slots[i1] = d_ot.d_slots[i2];
     d_ot.d_slots[i2] = tmp;
+#ifdef ST_INSTANCE_INDEX
+    if( cls1 != cls2 )
+    {
+        // the oops stay where they are, but now refer to an instance of the other class
+        removeInstance( cls1, firstPointer );
+        removeInstance( cls2, secondPointer );
+        addInstance( cls2, firstPointer );
+        addInstance( cls1, secondPointer );
+    }
+#endif
 }
 
 bool ObjectMemory2::hasObject(OOP ptr) const
@@ -471,13 +831,13 @@ QByteArrayList ObjectMemory2::allInstVarNames(ObjectMemory2::OOP cls, bool recur
         if( super && super != objectNil )
             res += allInstVarNames(super,recursive);
     }
-    const quint16 vars = fetchPointerOfObject(4,cls);
+    const OOP vars = fetchPointerOfObject(4,cls);
     if( vars != objectNil )
     {
         const quint16 len = fetchWordLenghtOf(vars);
         for( int i = 0; i < len; i++ )
         {
-            const quint16 str = fetchPointerOfObject(i,vars);
+            const OOP str = fetchPointerOfObject(i,vars);
             res << (const char*) fetchByteString(str).d_bytes;
         }
     }
@@ -486,18 +846,19 @@ QByteArrayList ObjectMemory2::allInstVarNames(ObjectMemory2::OOP cls, bool recur
 
 QByteArray ObjectMemory2::fetchClassName(OOP classPointer) const
 {
+    ensureRefs();
     if( d_classes.contains(classPointer) )
     {
-        const quint16 sym = fetchPointerOfObject(6, classPointer);
+        const OOP sym = fetchPointerOfObject(6, classPointer);
         //Q_ASSERT( fetchClassOf(sym) == classSymbol );
         return (const char*)fetchByteString(sym).d_bytes;
     }else if( d_metaClasses.contains(classPointer) )
     {
-        const quint16 nameId = fetchPointerOfObject(6, classPointer);
+        const OOP nameId = fetchPointerOfObject(6, classPointer);
         //const quint16 nameCls = fetchClassOf(nameId);
         //Q_ASSERT( nameCls != classSymbol );
         //Q_ASSERT( nameCls == classPointer );
-        const quint16 sym = fetchWordOfObject(6, nameId);
+        const OOP sym = fetchPointerOfObject(6, nameId);
         //Q_ASSERT( fetchClassOf(sym) == classSymbol );
         const ByteString bs = fetchByteString(sym);
         return QByteArray((const char*)bs.d_bytes) + " class";
@@ -633,14 +994,15 @@ bool ObjectMemory2::isIntegerObject(ObjectMemory2::OOP objectPointer)
     return isInt(objectPointer);
 }
 
-qint16 ObjectMemory2::integerValueOf(OOP objectPointer, bool doAssert)
+ObjectMemory2::SmallInt ObjectMemory2::integerValueOf(OOP objectPointer, bool doAssert)
 {
     if( isInt(objectPointer) )
     {
-        quint16 tcomp = ( objectPointer >> 1 );
-        if( tcomp & 0x4000 )
+        const OOP sign = OOP(1) << ( sizeof(OOP) * 8 - 2 ); // 0x4000 or 0x40000000
+        OOP tcomp = ( objectPointer >> 1 );
+        if( tcomp & sign )
         {
-            qint16 res = -( ~tcomp & 0x7fff ) - 1;
+            SmallInt res = -SmallInt( ~tcomp & ( ( sign << 1 ) - 1 ) ) - 1;
             return res;
         }else
             return tcomp;
@@ -650,7 +1012,7 @@ qint16 ObjectMemory2::integerValueOf(OOP objectPointer, bool doAssert)
         return 0;
 }
 
-ObjectMemory2::OOP ObjectMemory2::integerObjectOf(qint16 value)
+ObjectMemory2::OOP ObjectMemory2::integerObjectOf(SmallInt value)
 {
     OOP res = 0;
     if( value >= 0 )
@@ -664,12 +1026,16 @@ ObjectMemory2::OOP ObjectMemory2::integerObjectOf(qint16 value)
     return res;
 }
 
-bool ObjectMemory2::isIntegerValue(int valueWord)
+bool ObjectMemory2::isIntegerValue(qint64 valueWord)
 {
     // BB description: Return true if value can be represented as an instance of SmallInteger, false if not
     // BB states "valueWord <= -16384 && valueWord > 16834;" which contradicts with the description
     // Note the additional typo error in "16834" which should state "16384"!
+#ifdef ST_OOP32
+    return valueWord >= -1073741824 && valueWord <= 1073741823;
+#else
     return valueWord >= -16384 && valueWord <= 16383;
+#endif
 }
 
 int ObjectMemory2::largeIntegerValueOf(OOP integerPointer) const
@@ -743,6 +1109,10 @@ ObjectMemory2::OOP ObjectMemory2::instantiateClass(ObjectMemory2::OOP cls, quint
     if( slot < 0 )
     {
         collectGarbage();
+#ifdef ST_OOP32
+        if( d_freeSlots.size() < d_ot.d_slots.size() / 4 )
+            growObjectTable(); // don't wait until the collector runs after each few allocations
+#endif
         slot = findFreeSlot();
     }
     if( slot < 0 )
@@ -755,51 +1125,114 @@ ObjectMemory2::OOP ObjectMemory2::instantiateClass(ObjectMemory2::OOP cls, quint
         qCritical() << "ERROR: cannot allocate object, no free memory";
         return 0;
     }
+#ifdef ST_INSTANCE_INDEX
+    addInstance( cls, slot << 1 );
+#endif
+#ifdef ST_MEMORY_STATS
+    d_stats.d_allocations++;
+    d_stats.d_allocatedBytes += byteLen;
+    Stats::PerClass& pc = d_stats.d_perClass[cls];
+    pc.d_count++;
+    pc.d_bytes += byteLen;
+    if( d_freeSlots.size() < d_stats.d_minFreeSlots )
+        d_stats.d_minFreeSlots = d_freeSlots.size();
+    if( d_sampleInterval != 0 )
+    {
+        d_sampleCountdown -= d_sampleBytes ? byteLen : 1;
+        if( d_sampleCountdown <= 0 )
+        {
+            d_sampleCountdown += d_sampleInterval;
+            sampleAllocation( cls, byteLen );
+        }
+    }
+#endif
     return slot << 1;
 }
 
+#ifdef ST_OOP32
+void ObjectMemory2::growObjectTable()
+{
+    const int maxSlots = 0x7fffffff >> 2; // keeps asOop in the positive SmallInteger range
+    const int oldSize = d_ot.d_slots.size();
+    const int newSize = qMin( oldSize * 2, maxSlots );
+    if( newSize <= oldSize )
+        return;
+    d_ot.d_slots.resize( newSize );
+    for( int i = oldSize; i < newSize; i++ )
+        d_freeSlots.enqueue(i);
+#ifdef ST_INSTANCE_INDEX
+    d_instances.resize( newSize ); // the bitmaps grow with the next instance
+#endif
+    setupWorkers();
+    qDebug() << "INFO: object table grown to" << newSize << "slots";
+}
+#endif
+
 void ObjectMemory2::collectGarbage()
 {
-#if 0 // not necessary
-    for( int i = 0; i < d_ot.d_slots.size(); i++ )
+    int count = 0;
+#ifdef ST_MEMORY_STATS
+    quint32 survivors = 0;
+    d_stats.gcStart();
+    if( !collectGarbageParallel(count, survivors) )
+#else
+    if( !collectGarbageParallel(count) )
+#endif
     {
-        const OtSlot& s = d_ot.d_slots[i];
-        if( s.isFree() )
-            continue;
-        s.d_obj->d_flags.set(Object::Marked, false);
-    }
+#if 0 // not necessary
+        for( int i = 0; i < d_ot.d_slots.size(); i++ )
+        {
+            const OtSlot& s = d_ot.d_slots[i];
+            if( s.isFree() )
+                continue;
+            s.d_obj->d_flags.set(Object::Marked, false);
+        }
 #endif
 
-    d_freeSlots.clear();
+        d_freeSlots.clear();
 
-    // mark
-    foreach( quint16 reg, d_registers )
-        mark(reg);
-    foreach( quint16 reg, d_temps )
-        mark(reg);
-    for( int oop = 0; oop <= classSymbol; oop += 2 )
-    {
-        mark( oop );
-    }
+        // mark
+        foreach( OOP reg, d_registers )
+            mark(reg);
+        foreach( OOP reg, d_temps )
+            mark(reg);
+        for( int oop = 0; oop <= classSymbol; oop += 2 )
+        {
+            mark( oop );
+        }
+#ifdef ST_MEMORY_STATS
+        d_stats.markDone();
+#endif
 
-    int count = 0;
-    // sweep
-    for( int i = 0; i < d_ot.d_slots.size(); i++ )
-    {
-        const OtSlot& s = d_ot.d_slots[i];
-        if( s.isFree() )
-            continue;
-        if( !s.d_obj->d_flags.test(Object::Marked) )
+        // sweep
+        for( int i = 0; i < d_ot.d_slots.size(); i++ )
         {
+            const OtSlot& s = d_ot.d_slots[i];
+            if( s.isFree() )
+                continue;
+            if( !s.d_obj->d_flags.test(Object::Marked) )
+            {
 #ifdef _ST_COUNT_INSTS_
-            s_countByClass[ d_ot.d_slots[i].getClass() ]--;
+                s_countByClass[ d_ot.d_slots[i].getClass() ]--;
 #endif
-            d_ot.free(i);
-            d_freeSlots.enqueue(i);
-            count++;
-        }else
-            s.d_obj->d_flags.set(Object::Marked, false);
+#ifdef ST_INSTANCE_INDEX
+                removeInstance( s.getClass(), i << 1 );
+#endif
+                d_ot.free(i);
+                d_freeSlots.enqueue(i);
+                count++;
+            }else
+            {
+                s.d_obj->d_flags.set(Object::Marked, false);
+#ifdef ST_MEMORY_STATS
+                survivors++;
+#endif
+            }
+        }
     }
+#ifdef ST_MEMORY_STATS
+    d_stats.gcDone( survivors, count );
+#endif
 
     const int percent = count * 100 / d_ot.d_slots.size();
     if( percent < 40 )
@@ -826,7 +1259,7 @@ void ObjectMemory2::mark(OOP oop)
     {
         for( int i = 0; i < s.d_size; i++ )
         {
-            quint16 sub = fetchPointerOfObject(i, oop);
+            OOP sub = fetchPointerOfObject(i, oop);
             if( isPointer(sub) )
                 mark( sub );
         }
@@ -835,7 +1268,7 @@ void ObjectMemory2::mark(OOP oop)
         const quint16 len = literalCountOf(oop);
         for( int i = 0; i < len; i++ )
         {
-            quint16 sub = literalOfMethod(i, oop);
+            OOP sub = literalOfMethod(i, oop);
             if( isPointer(sub) )
                 mark( sub );
         }
@@ -851,40 +1284,44 @@ void ObjectMemory2::updateRefs()
     d_classes.clear();
     d_metaClasses.clear();
     d_freeSlots.clear();
+    d_refsValid = true;
 
-    for( int i = 0; i < d_ot.d_slots.size(); i++ )
+    if( !updateRefsParallel() )
     {
-        const OtSlot& slot = d_ot.d_slots[i];
-        if( slot.isFree() )
-        {
-            if( i != 0 )
-                d_freeSlots.enqueue(i);
-            continue;
-        }
-        const quint16 oop = i << 1;
-        Q_ASSERT( !d_objects.contains(oop) );
-        d_objects << oop;
-
-        const OOP cls = slot.getClass();
-        d_classes << cls;
-        d_classes << fetchPointerOfObject(0,cls); // superclass of cls
-        if( cls == classCompiledMethod )
+        for( int i = 0; i < d_ot.d_slots.size(); i++ )
         {
-            for( int j = 0; j < literalCountOf(oop); j++ )
+            const OtSlot& slot = d_ot.d_slots[i];
+            if( slot.isFree() )
             {
-                const OOP ptr = literalOfMethod(j,oop);
-                if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
-                    d_xref[ptr].append(oop);
+                if( i != 0 )
+                    d_freeSlots.enqueue(i);
+                continue;
             }
-        }else if( hasPointerMembers(oop) )
-        {
-
-            const int len = fetchWordLenghtOf(oop);
-            for( int j = 0; j < len; j++ )
+            const OOP oop = i << 1;
+            Q_ASSERT( !d_objects.contains(oop) );
+            d_objects << oop;
+
+            const OOP cls = slot.getClass();
+            d_classes << cls;
+            d_classes << fetchPointerOfObject(0,cls); // superclass of cls
+            if( cls == classCompiledMethod )
             {
-                quint16 ptr = fetchPointerOfObject(j,oop);
-                if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
-                    d_xref[ptr].append(oop);
+                for( int j = 0; j < literalCountOf(oop); j++ )
+                {
+                    const OOP ptr = literalOfMethod(j,oop);
+                    if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
+                        d_xref[ptr].append(oop);
+                }
+            }else if( hasPointerMembers(oop) )
+            {
+
+                const int len = fetchWordLenghtOf(oop);
+                for( int j = 0; j < len; j++ )
+                {
+                    OOP ptr = fetchPointerOfObject(j,oop);
+                    if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
+                        d_xref[ptr].append(oop);
+                }
             }
         }
     }
@@ -893,17 +1330,17 @@ void ObjectMemory2::updateRefs()
 
     d_objects -= d_classes;
 
-    foreach( quint16 cls, d_classes )
+    foreach( OOP cls, d_classes )
     {
-        const quint16 nameId = fetchPointerOfObject(6, cls);
-        const quint16 nameCls = fetchClassOf(nameId);
+        const OOP nameId = fetchPointerOfObject(6, cls);
+        const OOP nameCls = fetchClassOf(nameId);
         if( cls == nameCls && cls != classSymbol )
             d_metaClasses << cls;
     }
     d_classes -= d_metaClasses;
 
-    QSet<quint16> corrections;
-    foreach( quint16 obj, d_objects )
+    QSet<OOP> corrections;
+    foreach( OOP obj, d_objects )
     {
         if( d_metaClasses.contains(fetchClassOf(obj)) )
             corrections.insert(obj); // obj is actually a class but was not identified because it has no instances
@@ -912,7 +1349,304 @@ void ObjectMemory2::updateRefs()
     d_classes += corrections;
 }
 
-ObjectMemory2::OtSlot* ObjectMemory2::ObjectTable::allocate(quint16 slot, quint32 numOfBytes, OOP cls, bool isPtr)
+// Parallel garbage collection:
+// Marking: each worker has its own mark stack and publishes part of it when it grows, so that idle workers
+// can steal it. Mark bits are kept in a separate bitmap (one bit per slot) and set atomically, so each object
+// is scanned by exactly one worker.
+// Sweeping and the updateRefs scan: each worker handles a contiguous range of slots and collects its results
+// in private lists which are then merged in slot order, so the outcome is the same as with the serial version.
+
+struct ObjectMemory2::GcContext
+{
+    struct Stack
+    {
+        QMutex d_lock;
+        QVector<OOP> d_shared;
+        QAtomicInt d_count; // d_shared.size(), can be read without the lock
+    };
+    struct Refs
+    {
+        QVector<OOP> d_objects, d_classes, d_free;
+        QVector< QPair<OOP,OOP> > d_xref; // referenced ptr, referencing oop
+    };
+    QVector<QAtomicInt> d_marks;
+    QList<Stack*> d_stacks;
+    QVector< QVector<OOP> > d_roots;
+    QAtomicInt d_idle;
+    QVector< QVector<OOP> > d_freed;
+#ifdef ST_MEMORY_STATS
+    QVector<quint32> d_survivors;
+#endif
+    QVector<Refs> d_refs;
+    int d_rangeLen;
+    GcContext():d_rangeLen(0){}
+    ~GcContext() { qDeleteAll(d_stacks); }
+};
+
+struct ObjectMemory2::GcTask : public QRunnable
+{
+    ObjectMemory2* d_om;
+    GcContext& d_ctx;
+    GcJob d_job;
+    int d_worker;
+    GcTask(ObjectMemory2* om, GcContext& ctx, GcJob job, int worker):d_om(om),d_ctx(ctx),d_job(job),d_worker(worker){}
+    void run() { (d_om->*d_job)(d_ctx,d_worker); }
+};
+
+void ObjectMemory2::runOnWorkers(GcContext& ctx, GcJob job)
+{
+    for( int i = 1; i < d_workers; i++ )
+        d_pool->start( new GcTask( this, ctx, job, i ) );
+    (this->*job)(ctx,0);
+    d_pool->waitForDone();
+}
+
+#ifdef ST_MEMORY_STATS
+bool ObjectMemory2::collectGarbageParallel(int& count, quint32& survivors)
+#else
+bool ObjectMemory2::collectGarbageParallel(int& count)
+#endif
+{
+    if( d_pool == 0 )
+        return false;
+
+    GcContext ctx;
+    const int slotCount = d_ot.d_slots.size();
+    ctx.d_marks.resize( ( slotCount + 31 ) / 32 );
+    ctx.d_roots.resize( d_workers );
+    for( int i = 0; i < d_workers; i++ )
+        ctx.d_stacks.append( new GcContext::Stack() );
+
+    // mark
+    int w = 0;
+    foreach( OOP reg, d_registers )
+        ctx.d_roots[ w++ % d_workers ].append( reg );
+    foreach( OOP reg, d_temps )
+        ctx.d_roots[ w++ % d_workers ].append( reg );
+    for( int oop = 0; oop <= classSymbol; oop += 2 )
+        ctx.d_roots[ w++ % d_workers ].append( oop );
+    runOnWorkers( ctx, &ObjectMemory2::markJob );
+#ifdef ST_MEMORY_STATS
+    d_stats.markDone();
+    ctx.d_survivors.fill( 0, d_workers );
+#endif
+
+    // sweep
+    // ranges of whole 64 slot words, so the workers clear disjoint words of the instance bitmaps
+    ctx.d_rangeLen = ( ( slotCount + d_workers - 1 ) / d_workers + 63 ) & ~63;
+    ctx.d_freed.resize( d_workers );
+    runOnWorkers( ctx, &ObjectMemory2::sweepJob );
+
+    d_freeSlots.clear();
+    count = 0;
+    for( int i = 0; i < d_workers; i++ )
+    {
+        const QVector<OOP>& freed = ctx.d_freed[i];
+        for( int j = 0; j < freed.size(); j++ )
+            d_freeSlots.enqueue( freed[j] );
+        count += freed.size();
+#ifdef ST_MEMORY_STATS
+        survivors += ctx.d_survivors[i];
+#endif
+    }
+    return true;
+}
+
+void ObjectMemory2::markJob(GcContext& ctx, int worker)
+{
+    QVector<OOP> stack = ctx.d_roots[worker];
+    GcContext::Stack* own = ctx.d_stacks[worker];
+    QAtomicInt* marks = ctx.d_marks.data();
+
+    while( true )
+    {
+        while( !stack.isEmpty() )
+        {
+            const OOP oop = stack.last();
+            stack.removeLast();
+            if( !isPointer(oop) )
+                continue;
+            const OtSlot& s = getSlot(oop);
+            if( s.isFree() )
+                continue;
+            const int i = oop >> 1;
+            const int bit = 1 << ( i & 31 );
+            if( marks[ i >> 5 ].fetchAndOrOrdered( bit ) & bit )
+                continue; // already visited
+
+            if( s.d_isPtr )
+            {
+                for( int j = 0; j < s.d_size; j++ )
+                {
+                    const OOP sub = fetchPointerOfObject(j, oop);
+                    if( isPointer(sub) )
+                        stack.append( sub );
+                }
+            }else if( s.getClass() == classCompiledMethod )
+            {
+                const quint16 len = literalCountOf(oop);
+                for( int j = 0; j < len; j++ )
+                {
+                    const OOP sub = literalOfMethod(j, oop);
+                    if( isPointer(sub) )
+                        stack.append( sub );
+                }
+            }
+            stack.append( s.getClass() );
+
+            if( stack.size() > s_markStackShare && own->d_count.loadAcquire() == 0 )
+            {
+                QMutexLocker lock( &own->d_lock );
+                const int half = stack.size() / 2;
+                own->d_shared = stack.mid( 0, half );
+                stack.remove( 0, half );
+                own->d_count.storeRelease( own->d_shared.size() );
+            }
+        }
+
+        // own stack is empty; take the shared part of our own or another worker's stack
+        bool found = false;
+        for( int n = 0; n < d_workers && !found; n++ )
+        {
+            GcContext::Stack* victim = ctx.d_stacks[ ( worker + n ) % d_workers ];
+            if( victim->d_count.loadAcquire() == 0 )
+                continue;
+            QMutexLocker lock( &victim->d_lock );
+            if( victim->d_shared.isEmpty() )
+                continue;
+            stack = victim->d_shared;
+            victim->d_shared.clear();
+            victim->d_count.storeRelease( 0 );
+            found = true;
+        }
+        if( found )
+            continue;
+
+        // only idle workers left means there is nothing more to mark
+        ctx.d_idle.fetchAndAddOrdered( 1 );
+        while( true )
+        {
+            if( ctx.d_idle.loadAcquire() == d_workers )
+                return;
+            bool shared = false;
+            for( int n = 0; n < d_workers && !shared; n++ )
+                shared = ctx.d_stacks[n]->d_count.loadAcquire() != 0;
+            if( shared )
+            {
+                ctx.d_idle.fetchAndAddOrdered( -1 );
+                break;
+            }
+            QThread::yieldCurrentThread();
+        }
+    }
+}
+
+void ObjectMemory2::sweepJob(GcContext& ctx, int worker)
+{
+    const int from = worker * ctx.d_rangeLen;
+    const int to = qMin( from + ctx.d_rangeLen, d_ot.d_slots.size() );
+    const QAtomicInt* marks = ctx.d_marks.constData();
+    QVector<OOP>& freed = ctx.d_freed[worker];
+
+    for( int i = from; i < to; i++ )
+    {
+        const OtSlot& s = getSlot( i << 1 );
+        if( s.isFree() )
+            continue;
+        if( ( marks[ i >> 5 ].loadAcquire() & ( 1 << ( i & 31 ) ) ) == 0 )
+        {
+#ifdef ST_INSTANCE_INDEX
+            removeInstance( s.getClass(), i << 1 );
+#endif
+            d_ot.free(i);
+            freed.append(i);
+        }
+#ifdef ST_MEMORY_STATS
+        else
+            ctx.d_survivors[worker]++;
+#endif
+    }
+}
+
+bool ObjectMemory2::updateRefsParallel()
+{
+    if( d_pool == 0 )
+        return false;
+
+    GcContext ctx;
+    ctx.d_rangeLen = ( d_ot.d_slots.size() + d_workers - 1 ) / d_workers;
+    ctx.d_refs.resize( d_workers );
+    runOnWorkers( ctx, &ObjectMemory2::scanRefsJob );
+
+    for( int w = 0; w < d_workers; w++ )
+    {
+        const GcContext::Refs& r = ctx.d_refs[w];
+        for( int i = 0; i < r.d_free.size(); i++ )
+            d_freeSlots.enqueue( r.d_free[i] );
+        for( int i = 0; i < r.d_objects.size(); i++ )
+            d_objects << r.d_objects[i];
+        for( int i = 0; i < r.d_classes.size(); i++ )
+            d_classes << r.d_classes[i];
+        for( int i = 0; i < r.d_xref.size(); i++ )
+            d_xref[ r.d_xref[i].first ].append( r.d_xref[i].second );
+    }
+    return true;
+}
+
+void ObjectMemory2::scanRefsJob(GcContext& ctx, int worker)
+{
+    const int from = worker * ctx.d_rangeLen;
+    const int to = qMin( from + ctx.d_rangeLen, d_ot.d_slots.size() );
+    GcContext::Refs& r = ctx.d_refs[worker];
+
+    for( int i = from; i < to; i++ )
+    {
+        const OOP oop = i << 1;
+        const OtSlot& slot = getSlot(oop);
+        if( slot.isFree() )
+        {
+            if( i != 0 )
+                r.d_free.append(i);
+            continue;
+        }
+        r.d_objects.append(oop);
+
+        const OOP cls = slot.getClass();
+        r.d_classes.append( cls );
+        r.d_classes.append( fetchPointerOfObject(0,cls) ); // superclass of cls
+        if( cls == classCompiledMethod )
+        {
+            for( int j = 0; j < literalCountOf(oop); j++ )
+            {
+                const OOP ptr = literalOfMethod(j,oop);
+                if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
+                    r.d_xref.append( qMakePair(ptr,oop) );
+            }
+        }else if( slot.d_isPtr )
+        {
+            const int len = fetchWordLenghtOf(oop);
+            for( int j = 0; j < len; j++ )
+            {
+                const OOP ptr = fetchPointerOfObject(j,oop);
+                if( !isInt(ptr) && ptr != objectNil && ptr != objectTrue && ptr != objectFalse )
+                    r.d_xref.append( qMakePair(ptr,oop) );
+            }
+        }
+    }
+}
+
+quint32 ObjectMemory2::OtSlot::dataLen() const
+{
+#ifdef ST_OOP32
+    if( d_isPtr )
+        return d_size * sizeof(OOP);
+    if( d_hasFrame )
+        return frameOffset(d_size) + d_size * sizeof(OOP);
+#endif
+    return d_size << 1;
+}
+
+ObjectMemory2::OtSlot* ObjectMemory2::ObjectTable::allocate(OOP slot, quint32 numOfBytes, OOP cls, bool isPtr)
 {
     Q_ASSERT( slot < d_slots.size() && d_slots[slot].d_obj == 0 );
     bool isOdd = false;
@@ -921,7 +1655,19 @@ ObjectMemory2::OtSlot* ObjectMemory2::ObjectTable::allocate(quint16 slot, quint3
         numOfBytes++;
         isOdd = true;
     }
-    const int byteLen = sizeof(Object) + numOfBytes - 1;
+    quint32 dataLen = numOfBytes;
+    bool frame = false;
+#ifdef ST_OOP32
+    if( isPtr )
+        dataLen = ( numOfBytes >> 1 ) * sizeof(OOP);
+    else if( cls == classCompiledMethod )
+    {
+        // room for a wide copy of header and literals; the literal count is not known here, so each word gets one
+        dataLen = OtSlot::frameOffset( numOfBytes >> 1 ) + ( numOfBytes >> 1 ) * sizeof(OOP);
+        frame = true;
+    }
+#endif
+    const int byteLen = sizeof(Object) + dataLen - 1;
     void* ptr = ::malloc( byteLen + 1 ); // additional 0 at end
     if( ptr == 0 )
         return 0;
@@ -930,19 +1676,213 @@ ObjectMemory2::OtSlot* ObjectMemory2::ObjectTable::allocate(quint16 slot, quint3
     ots.d_obj = (Object*) ptr;
     ots.d_isOdd = isOdd;
     ots.d_isPtr = isPtr;
+    ots.d_hasFrame = frame;
     ots.d_class = cls >> 1;
     ots.d_size = numOfBytes >> 1;
     return &ots;
 }
 
-void ObjectMemory2::ObjectTable::free(quint16 slot)
+void ObjectMemory2::ObjectTable::free(OOP slot)
 {
     Q_ASSERT( slot < d_slots.size() && d_slots[slot].d_obj != 0 );
     OtSlot& ots = d_slots[slot];
-    ::free( ots.d_obj );
+    if( !isMapped( ots.d_obj ) )
+        ::free( ots.d_obj );
     ots.d_obj = 0;
     ots.d_class = 0;
     ots.d_size = 0;
     ots.d_isOdd = 0;
     ots.d_isPtr = 0;
+    ots.d_hasFrame = 0;
+}
+
+#ifdef ST_MEMORY_STATS
+void ObjectMemory2::Stats::reset()
+{
+    d_allocations = 0;
+    d_allocatedBytes = 0;
+    d_collections = 0;
+    d_markUs = 0;
+    d_sweepUs = 0;
+    d_maxPauseUs = 0;
+    for( int i = 0; i < PauseBuckets; i++ )
+        d_pauses[i] = 0;
+    d_lastSurvivors = 0;
+    d_lastFreed = 0;
+    d_minFreeSlots = INT_MAX;
+    d_perClass.clear();
+    d_sites.clear();
+    d_markNs = 0;
+    d_since.start();
+}
+
+void ObjectMemory2::Stats::gcStart()
+{
+    d_gcTimer.start();
+    d_markNs = 0;
+}
+
+void ObjectMemory2::Stats::markDone()
+{
+    d_markNs = d_gcTimer.nsecsElapsed();
+}
+
+void ObjectMemory2::Stats::gcDone(quint32 survivors, quint32 freed)
+{
+    const qint64 total = d_gcTimer.nsecsElapsed();
+    const quint64 pause = total / 1000;
+    d_collections++;
+    d_markUs += d_markNs / 1000;
+    d_sweepUs += ( total - d_markNs ) / 1000;
+    if( pause > d_maxPauseUs )
+        d_maxPauseUs = pause;
+    int bucket = 0;
+    while( bucket < PauseBuckets - 1 && pause >= ( quint64(1) << bucket ) )
+        bucket++;
+    d_pauses[bucket]++;
+    d_lastSurvivors = survivors;
+    d_lastFreed = freed;
+}
+
+void ObjectMemory2::setAllocationSampling(quint32 interval, bool bytes, const SiteSource* src)
+{
+    d_sampleInterval = src ? interval : 0;
+    d_sampleBytes = bytes;
+    d_sampleCountdown = interval;
+    d_siteSource = src;
 }
+
+void ObjectMemory2::sampleAllocation(OOP cls, quint32 byteLen)
+{
+    OOP method = 0, receiverClass = 0, selector = 0;
+    qint16 pc = 0;
+    d_siteSource->allocationSite( method, pc, receiverClass, selector );
+    // the method oop can be collected and reused while sampling; the report resolves names at the end only
+    Stats::Site& site = d_stats.d_sites[ ( quint64(method) << 32 ) | quint16(pc) ];
+    if( site.d_samples == 0 )
+    {
+        site.d_method = method;
+        site.d_pc = pc;
+    }
+    site.d_receiverClass = receiverClass;
+    site.d_selector = selector;
+    site.d_samples++;
+    site.d_bytes += byteLen;
+    site.d_classes[cls]++;
+}
+
+QByteArray ObjectMemory2::methodName(OOP method, OOP cls) const
+{
+    // look for the method in the dictionaries of cls and its superclasses
+    const OOP start = cls;
+    int depth = 0;
+    while( isPointer(cls) && cls != objectNil && depth++ < 64 )
+    {
+        const OOP dict = fetchPointerOfObject( 1, cls );
+        if( isPointer(dict) && dict != objectNil && hasPointerMembers(dict) )
+        {
+            const OOP methods = fetchPointerOfObject( 1, dict );
+            const int len = isPointer(methods) && methods != objectNil ? fetchWordLenghtOf(methods) : 0;
+            for( int i = 0; i < len; i++ )
+            {
+                if( fetchPointerOfObject( i, methods ) == method )
+                    return fetchClassName(cls) + ">>" + fetchByteArray( fetchPointerOfObject( i + 2, dict ) );
+            }
+        }
+        cls = fetchPointerOfObject( 0, cls );
+    }
+    return fetchClassName(start) + ">>" + QByteArray::number(method,16);
+}
+
+static bool moreSamples( const ObjectMemory2::Stats::Site* lhs, const ObjectMemory2::Stats::Site* rhs )
+{
+    return lhs->d_samples > rhs->d_samples;
+}
+
+QByteArray ObjectMemory2::statsToJson() const
+{
+    const qint64 ms = qMax( qint64(1), d_stats.d_since.elapsed() );
+    QJsonObject res;
+    res["uptimeMs"] = ms;
+    res["allocations"] = qint64(d_stats.d_allocations);
+    res["allocatedBytes"] = qint64(d_stats.d_allocatedBytes);
+    res["allocationsPerSec"] = double(d_stats.d_allocations) * 1000.0 / ms;
+    res["collections"] = qint64(d_stats.d_collections);
+    res["markUs"] = qint64(d_stats.d_markUs);
+    res["sweepUs"] = qint64(d_stats.d_sweepUs);
+    res["maxPauseUs"] = qint64(d_stats.d_maxPauseUs);
+    res["lastSurvivors"] = qint64(d_stats.d_lastSurvivors);
+    res["lastFreed"] = qint64(d_stats.d_lastFreed);
+    res["objectTableSlots"] = d_ot.d_slots.size();
+    res["freeSlots"] = d_freeSlots.size();
+    res["minFreeSlots"] = d_stats.d_minFreeSlots == INT_MAX ? d_freeSlots.size() : d_stats.d_minFreeSlots;
+
+    QJsonArray pauses;
+    for( int i = 0; i < Stats::PauseBuckets; i++ )
+    {
+        QJsonObject b;
+        if( i < Stats::PauseBuckets - 1 )
+            b["belowUs"] = qint64(1) << i;
+        else
+            b["belowUs"] = QJsonValue();
+        b["count"] = qint64(d_stats.d_pauses[i]);
+        pauses.append(b);
+    }
+    res["pauseHistogram"] = pauses;
+
+    QJsonArray classes;
+    QHash<OOP,Stats::PerClass>::const_iterator i;
+    for( i = d_stats.d_perClass.begin(); i != d_stats.d_perClass.end(); ++i )
+    {
+        QJsonObject c;
+        QByteArray name = fetchClassName(i.key());
+        if( name.isEmpty() )
+            name = QByteArray::number(i.key(),16);
+        c["class"] = QString::fromLatin1(name);
+        c["oop"] = qint64(i.key());
+        c["count"] = qint64(i.value().d_count);
+        c["bytes"] = qint64(i.value().d_bytes);
+        c["perSec"] = double(i.value().d_count) * 1000.0 / ms;
+        classes.append(c);
+    }
+    res["classes"] = classes;
+
+    if( d_sampleInterval != 0 )
+    {
+        res["sampleInterval"] = qint64(d_sampleInterval);
+        res["sampleUnit"] = d_sampleBytes ? "bytes" : "allocations";
+        const int maxSites = 100;
+        QList<const Stats::Site*> list;
+        QHash<quint64,Stats::Site>::const_iterator j;
+        for( j = d_stats.d_sites.begin(); j != d_stats.d_sites.end(); ++j )
+            list << &j.value();
+        std::sort( list.begin(), list.end(), moreSamples );
+        QJsonArray sites;
+        for( int k = 0; k < list.size() && k < maxSites; k++ )
+        {
+            const Stats::Site* site = list[k];
+            QJsonObject o;
+            o["method"] = QString::fromLatin1( methodName( site->d_method, site->d_receiverClass ) );
+            o["methodOop"] = qint64(site->d_method);
+            o["pc"] = site->d_pc;
+            o["receiverClass"] = QString::fromLatin1( fetchClassName( site->d_receiverClass ) );
+            o["selector"] = QString::fromLatin1( prettyValue( site->d_selector ) );
+            o["samples"] = qint64(site->d_samples);
+            o["sampledBytes"] = qint64(site->d_bytes);
+            QJsonArray created;
+            QHash<OOP,quint32>::const_iterator c;
+            for( c = site->d_classes.begin(); c != site->d_classes.end(); ++c )
+            {
+                QJsonObject cc;
+                cc["class"] = QString::fromLatin1( fetchClassName(c.key()) );
+                cc["samples"] = qint64(c.value());
+                created.append(cc);
+            }
+            o["creates"] = created;
+            sites.append(o);
+        }
+        res["sites"] = sites;
+    }
+    return QJsonDocument(res).toJson();
+}
+#endif
@@ -25,20 +25,39 @@
 #include <QVector>
 #include <bitset>
 #include <QQueue>
+#ifdef ST_MEMORY_STATS
+#include <QElapsedTimer>
+#endif
 
 class QIODevice;
+class QThreadPool;
+class QFile;
 
 namespace St
 {
+    // Define ST_OOP32 (e.g. in the .pro file) to use 32 bit object pointers and 31 bit SmallIntegers instead of
+    // the original 16 and 15 bits. This lifts the limit of 32k objects; the object table grows on demand.
+    // The image is still read in the 16 bit interchange format and widened when loaded.
+
     class ObjectMemory2 : public QObject
     {
     public:
+#ifdef ST_OOP32
+        typedef quint32 OOP;
+        typedef qint32 SmallInt;
+#else
         typedef quint16 OOP;
+        typedef qint16 SmallInt;
+#endif
 
         // Objects known to the interpreter
         enum KnownObjects {
             // small integers
+#ifdef ST_OOP32
+            objectMinusOne = 0xffffffff,
+#else
             objectMinusOne = 65535,
+#endif
             objectZero = 1,
             objectOne = 3,
             objectTwo = 5,
@@ -109,23 +128,82 @@ namespace St
 
         ObjectMemory2(QObject* p = 0);
         bool readFrom( QIODevice* );
+        bool writeTo( QIODevice* ) const; // interchange format
+        // native snapshot: host byte order and object layout of this build, mapped copy-on-write
+        static bool isSnapshot( QIODevice* );
+        bool mapSnapshot( const QString& path );
+        bool writeSnapshot( QIODevice* ) const;
         void collectGarbage();
         void updateRefs();
+        // the interpreter doesn't need objects, classes and xref; they are built on first use after loading
+        void ensureRefs() const { if( !d_refsValid ) const_cast<ObjectMemory2*>(this)->updateRefs(); }
 
-        QList<quint16> getAllValidOop() const;
-        const QSet<quint16>& getObjects() const {return d_objects; }
-        const QSet<quint16>& getClasses() const {return d_classes; }
-        const QSet<quint16>& getMetaClasses() const {return d_metaClasses; }
+        QList<OOP> getAllValidOop() const;
+        const QSet<OOP>& getObjects() const { ensureRefs(); return d_objects; }
+        const QSet<OOP>& getClasses() const { ensureRefs(); return d_classes; }
+        const QSet<OOP>& getMetaClasses() const { ensureRefs(); return d_metaClasses; }
         int getOopsLeft() const;
-        typedef QHash<quint16, QList<quint16> > Xref;
-        const Xref& getXref() const { return d_xref; }
-        void setRegister( quint8 index, quint16 value );
-        inline quint16 getRegister( quint8 index ) const;
+        typedef QHash<OOP, QList<OOP> > Xref;
+        const Xref& getXref() const { ensureRefs(); return d_xref; }
+        void setRegister( quint8 index, OOP value );
+        inline OOP getRegister( quint8 index ) const;
         void addTemp(OOP oop);
         void removeTemp(OOP oop);
         OOP getNextInstance( OOP cls, OOP cur = 0 ) const;
         QByteArray prettyValue( OOP oop ) const;
 
+        struct SiteSource
+        {
+            // the code currently running, i.e. the method, pc and receiver class of the allocating context,
+            // and the selector of the last send
+            virtual void allocationSite( OOP& method, qint16& pc, OOP& receiverClass, OOP& selector ) const = 0;
+            virtual ~SiteSource() {}
+        };
+
+#ifdef ST_MEMORY_STATS
+        struct Stats
+        {
+            enum { PauseBuckets = 20 }; // bucket i counts pauses shorter than 2^i us, the last one all longer ones
+            struct PerClass
+            {
+                quint64 d_count, d_bytes;
+                PerClass():d_count(0),d_bytes(0){}
+            };
+            quint64 d_allocations, d_allocatedBytes;
+            quint32 d_collections;
+            quint64 d_markUs, d_sweepUs, d_maxPauseUs; // mark and sweep are totals
+            quint32 d_pauses[PauseBuckets];
+            quint32 d_lastSurvivors, d_lastFreed;
+            int d_minFreeSlots; // low watermark since the last reset
+            QHash<OOP,PerClass> d_perClass;
+            struct Site
+            {
+                OOP d_method, d_receiverClass, d_selector;
+                qint16 d_pc;
+                quint32 d_samples;
+                quint64 d_bytes;
+                QHash<OOP,quint32> d_classes; // samples per instantiated class
+                Site():d_method(0),d_receiverClass(0),d_selector(0),d_pc(0),d_samples(0),d_bytes(0){}
+            };
+            QHash<quint64,Site> d_sites; // key is method and pc
+            QElapsedTimer d_since, d_gcTimer;
+            qint64 d_markNs;
+            Stats() { reset(); }
+            void reset();
+            void gcStart();
+            void markDone();
+            void gcDone( quint32 survivors, quint32 freed );
+        };
+        const Stats& getStats() const { return d_stats; }
+        void resetStats() { d_stats.reset(); }
+        QByteArray statsToJson() const;
+        // sample each interval-th allocation or byte; 0 switches sampling off
+        void setAllocationSampling( quint32 interval, bool bytes = false, const SiteSource* = 0 );
+        quint32 getSampleInterval() const { return d_sampleInterval; }
+        bool isSamplingBytes() const { return d_sampleBytes; }
+        QByteArray methodName( OOP method, OOP cls ) const;
+#endif
+
         // oop 0 is reserved as an invalid object pointer!
 
         bool hasPointerMembers( OOP objectPointer ) const;
@@ -168,16 +246,29 @@ namespace St
 
         static bool isPointer(OOP);
         static bool isIntegerObject(OOP objectPointer);
-        static qint16 integerValueOf(OOP objectPointer , bool doAssert = false);
-        static OOP integerObjectOf(qint16 value );
-        static bool isIntegerValue(int);
+        static SmallInt integerValueOf(OOP objectPointer , bool doAssert = false);
+        static OOP integerObjectOf(SmallInt value );
+        static bool isIntegerValue(qint64);
         int largeIntegerValueOf(OOP integerPointer) const;
-        static inline qint16 bitShift( qint16 wordToShift, qint16 offset );
+        static inline SmallInt bitShift( SmallInt wordToShift, qint16 offset );
 
     protected:
         int findFreeSlot();
         OOP instantiateClass(OOP cls, quint32 byteLen, bool isPtr );
         void mark(OOP);
+        struct GcContext;
+        struct GcTask;
+        typedef void (ObjectMemory2::*GcJob)(GcContext&,int worker);
+        void runOnWorkers(GcContext&, GcJob);
+#ifdef ST_MEMORY_STATS
+        bool collectGarbageParallel(int& count, quint32& survivors);
+#else
+        bool collectGarbageParallel(int& count);
+#endif
+        bool updateRefsParallel();
+        void markJob(GcContext&, int worker);
+        void sweepJob(GcContext&, int worker);
+        void scanRefsJob(GcContext&, int worker);
 
         static inline quint16 readU16( const QByteArray& data, int off )
         {
@@ -196,6 +287,17 @@ namespace St
             data[off+1] = val & 0xff;
         }
 
+#ifdef ST_OOP32
+        static inline OOP widen( quint16 oop16 )
+        {
+            // pointers keep their value, SmallIntegers are sign extended
+            if( oop16 & 1 )
+                return oop16 & 0x8000 ? oop16 | 0xffff0000 : oop16;
+            else
+                return oop16;
+        }
+#endif
+
     private:
         struct Object
         {
@@ -207,31 +309,67 @@ namespace St
         struct OtSlot
         {
             quint16 d_size; // number of words (16 bit per word); we need full 16 bit here!
-            quint16 d_class;    // NOTE: this is an index, not an OOP!
+            OOP d_class;    // NOTE: this is an index, not an OOP!
             quint8 d_isOdd : 1;
             quint8 d_isPtr : 1;
+            quint8 d_hasFrame : 1; // ST_OOP32 only: CompiledMethod with wide header and literals after the bytes
             Object* d_obj;
-            OtSlot():d_obj(0),d_size(0),d_isOdd(0),d_class(0),d_isPtr(0) {}
+            OtSlot():d_obj(0),d_size(0),d_isOdd(0),d_class(0),d_isPtr(0),d_hasFrame(0) {}
             bool isFree() const { return d_obj == 0; }
             OOP getClass() const { return d_class << 1; }
             quint32 byteLen() const { return ( d_size << 1 ) - ( d_isOdd ? 1 : 0 ); }
+            quint32 dataLen() const; // bytes allocated for d_obj->d_data
+#ifdef ST_OOP32
+            // pointer objects store one OOP per field in native byte order; d_size is the number of fields
+            OOP* oops() const { return (OOP*)( d_isPtr ? d_obj->d_data : d_obj->d_data + frameOffset(d_size) ); }
+            static quint32 frameOffset( quint16 size ) { return ( ( size << 1 ) + 3 ) & ~3; }
+#endif
         };
 
         struct ObjectTable
         {
             QVector<OtSlot> d_slots;
-            ObjectTable():d_slots( 0xffff >> 1 ) {}
-            OtSlot* allocate(quint16 slot, quint32 numOfBytes, OOP cls, bool isPtr );
-            void free( quint16 slot );
+            const quint8* d_mapped; // objects from a snapshot live here and are not malloced
+            quint64 d_mappedLen;
+            ObjectTable():d_slots( 0xffff >> 1 ),d_mapped(0),d_mappedLen(0) {}
+            OtSlot* allocate(OOP slot, quint32 numOfBytes, OOP cls, bool isPtr );
+            void free( OOP slot );
+            bool isMapped( const Object* obj ) const
+            {
+                return d_mapped != 0 && (const quint8*)obj >= d_mapped && (const quint8*)obj < d_mapped + d_mappedLen;
+            }
         };
 
         ObjectTable d_ot;
         inline const OtSlot& getSlot( OOP oop ) const;
-        QSet<quint16> d_objects, d_classes, d_metaClasses;
-        QVector<quint16> d_registers;
-        QSet<quint16> d_temps;
-        QQueue<quint16> d_freeSlots;
+#ifdef ST_OOP32
+        void growObjectTable();
+#endif
+        void setupWorkers();
+#ifdef ST_INSTANCE_INDEX
+        void addInstance( OOP cls, OOP oop );
+        void removeInstance( OOP cls, OOP oop );
+        QVector< QVector<quint64> > d_instances; // class slot -> bitmap of the slots of its instances
+#endif
+        void buildInstances();
+        void collectFreeSlots();
+        QSet<OOP> d_objects, d_classes, d_metaClasses;
+        QVector<OOP> d_registers;
+        QSet<OOP> d_temps;
+        QQueue<OOP> d_freeSlots;
         Xref d_xref;
+        bool d_refsValid;
+#ifdef ST_MEMORY_STATS
+        Stats d_stats;
+        const SiteSource* d_siteSource;
+        quint32 d_sampleInterval;
+        qint64 d_sampleCountdown;
+        bool d_sampleBytes;
+        void sampleAllocation( OOP cls, quint32 byteLen );
+#endif
+        QThreadPool* d_pool;
+        int d_workers;
+        QFile* d_snapshot;
     };
 
     const ObjectMemory2::OtSlot& ObjectMemory2::getSlot(ObjectMemory2::OOP oop) const
@@ -254,14 +392,18 @@ namespace St
 //            QByteArray("WARNING: accessing word or byte object by pointer"); // never happened so far; happens in method literals by primitiveObjectAt
 
         Q_ASSERT( fieldIndex < s.d_size );
+#ifdef ST_OOP32
+        const OOP oop = s.d_isPtr || s.d_hasFrame ? s.oops()[fieldIndex] : widen( readU16( s.d_obj->d_data, off ) );
+#else
         const OOP oop = readU16( s.d_obj->d_data, off );
+#endif
         if( oop == 0 ) // BB (implicitly?) assumes that unused members are nil
             return objectNil;
         else
             return oop;
     }
 
-    quint16 ObjectMemory2::getRegister(quint8 index) const
+    ObjectMemory2::OOP ObjectMemory2::getRegister(quint8 index) const
     {
         if( index < d_registers.size() )
             return d_registers[index];
@@ -269,7 +411,7 @@ namespace St
             return 0;
     }
 
-    qint16 ObjectMemory2::bitShift(qint16 wordToShift, qint16 offset)
+    ObjectMemory2::SmallInt ObjectMemory2::bitShift(SmallInt wordToShift, qint16 offset)
     {
         if( offset >= 0 )
             return wordToShift << offset;
@@ -281,7 +423,7 @@ namespace St
                 // BB: the sign bit is extended in right shifts
                 // see also https://stackoverflow.com/questions/1857928/right-shifting-negative-numbers-in-c
                 // and https://stackoverflow.com/questions/31879878/how-can-i-perform-arithmetic-right-shift-in-c-in-a-portable-way
-                quint16 tmp = wordToShift;
+                OOP tmp = wordToShift; // OOP is used as the unsigned variant of SmallInt
 #if 0
                 for( int i = 0; i < offset; i++ )
                 {
@@ -289,7 +431,7 @@ namespace St
                     tmp |= 0x8000;
                 }
 #else
-                const quint16 tmp2 = -((wordToShift & (1u << 15)) >> offset);
+                const OOP tmp2 = -((wordToShift & (1u << ( sizeof(OOP) * 8 - 1 ))) >> offset);
                 tmp = tmp >> offset | tmp2;
 //              qDebug() << "before" << QByteArray::number(quint16(wordToShift),2)
 //                     << "after" << QByteArray::number(tmp,2)
@@ -309,6 +451,16 @@ namespace St
         const OtSlot& s = getSlot(objectPointer);
         const quint32 off = fieldIndex * 2;
         Q_ASSERT( fieldIndex < s.d_size );
+#ifdef ST_OOP32
+        if( s.d_isPtr )
+        {
+            s.oops()[fieldIndex] = withValue;
+            return;
+        }
+        if( s.d_hasFrame )
+            s.oops()[fieldIndex] = withValue;
+        // keep the 16 bit view up to date; the header is a SmallInteger with the same low 16 bits in both widths
+#endif
         writeU16( s.d_obj->d_data, off, withValue );
     }
 
@@ -0,0 +1,206 @@
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StScreenRecorder.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QStringList>
+#include <QTextStream>
+#include <QtDebug>
+#include <stdio.h>
+using namespace St;
+
+// Rebuilds the screen from a log written by ScreenRecorder (VM option -record) and writes
+// frames as PNG files or as raw 8 bit gray video on stdout, e.g. for
+// St80ScreenPlayer -raw screen.strec | ffmpeg -f rawvideo -pix_fmt gray -s 640x480 -r 30 -i - out.mp4
+
+static QImage toImage( const QByteArray& screen, int width, int height )
+{
+    QImage img( width, height, QImage::Format_Mono );
+    img.setColor( 0, qRgb( 255, 255, 255 ) ); // Smalltalk uses 1 for black
+    img.setColor( 1, qRgb( 0, 0, 0 ) );
+    const int lineLen = ( ( width + 15 ) / 16 ) * 2;
+    const int copyLen = qMin( lineLen, img.bytesPerLine() );
+    for( int y = 0; y < height; y++ )
+        ::memcpy( img.scanLine(y), screen.constData() + y * lineLen, copyLen );
+    return img;
+}
+
+struct FrameSink
+{
+    QString d_dir;
+    bool d_raw;
+    int d_count;
+    QByteArray d_gray;
+    FrameSink():d_raw(false),d_count(0) {}
+    bool write( const QByteArray& screen, int width, int height )
+    {
+        if( d_raw )
+        {
+            // one byte per pixel, 0 black, 255 white
+            const int lineLen = ( ( width + 15 ) / 16 ) * 2;
+            d_gray.resize( width * height );
+            for( int y = 0; y < height; y++ )
+            {
+                const quint8* src = (const quint8*)screen.constData() + y * lineLen;
+                quint8* dst = (quint8*)d_gray.data() + y * width;
+                for( int x = 0; x < width; x++ )
+                    dst[x] = ( ( src[x>>3] >> ( 7 - ( x & 7 ) ) ) & 1 ) ? 0 : 255;
+            }
+            d_count++;
+            return ::fwrite( d_gray.constData(), 1, d_gray.size(), stdout ) == size_t(d_gray.size());
+        }
+        const QString path = QDir(d_dir).absoluteFilePath( QString("frame_%1.png").arg( d_count++, 6, 10, QChar('0') ) );
+        if( !toImage( screen, width, height ).save( path ) )
+        {
+            qCritical() << "ERROR: cannot write" << path;
+            return false;
+        }
+        return true;
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    a.setOrganizationName("me@rochus-keller.ch");
+    a.setOrganizationDomain("github.com/rochus-keller/Smalltalk");
+    a.setApplicationName("Smalltalk 80 Screen Player");
+    a.setApplicationVersion("0.1");
+
+    QTextStream out(stderr);
+    QString logPath;
+    FrameSink sink;
+    sink.d_dir = ".";
+    bool each = false;
+    bool info = false;
+    int fps = 0;
+    const QStringList args = QCoreApplication::arguments();
+    for( int i = 1; i < args.size(); i++ )
+    {
+        if( args[i] == "-h" || args.size() == 1 )
+        {
+            out << a.applicationName() << " version: " << a.applicationVersion() <<
+                   " author: me@rochus-keller.ch  license: GPL" << endl;
+            out << "usage: [options] recording_file" << endl;
+            out << "options:" << endl;
+            out << "  -png dir  write frame_nnnnnn.png files to dir (default)" << endl;
+            out << "  -raw      write 8 bit gray frames to stdout" << endl;
+            out << "  -fps n    frames at a fixed rate of the recorded time, 1..1000" << endl;
+            out << "  -each     one frame per record instead of one per recorded frame" << endl;
+            out << "  -info     only print statistics of the recording" << endl;
+            out << "  -h        display this information" << endl;
+            return 0;
+        }else if( args[i] == "-png" && i + 1 < args.size() )
+            sink.d_dir = args[++i];
+        else if( args[i] == "-raw" )
+            sink.d_raw = true;
+        else if( args[i] == "-fps" && i + 1 < args.size() )
+        {
+            fps = args[++i].toInt();
+            if( fps < 1 || fps > 1000 )
+            {
+                qCritical() << "error: -fps must be between 1 and 1000" << endl;
+                return -1;
+            }
+        }
+        else if( args[i] == "-each" )
+            each = true;
+        else if( args[i] == "-info" )
+            info = true;
+        else if( !args[i].startsWith('-') && logPath.isEmpty() )
+            logPath = args[i];
+        else
+        {
+            qCritical() << "error: invalid command line option " << args[i] << endl;
+            return -1;
+        }
+    }
+
+    QFile f(logPath);
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        qCritical() << "ERROR: cannot open" << logPath;
+        return -1;
+    }
+    ScreenLogReader r(&f);
+    if( !r.readHeader() )
+    {
+        qCritical() << "ERROR:" << r.getError();
+        return -1;
+    }
+    if( !sink.d_raw && !info && !QDir().mkpath( sink.d_dir ) )
+    {
+        qCritical() << "ERROR: cannot create" << sink.d_dir;
+        return -1;
+    }
+
+    QByteArray screen;
+    ScreenLogReader::Record rec;
+    quint32 records = 0, first = 0, last = 0;
+    qint64 pixels = 0;
+    qint64 startMs = -1, frameNo = 0;
+    while( r.readRecord( rec ) )
+    {
+        if( records == 0 )
+            first = rec.d_ms;
+        records++;
+        pixels += qint64(rec.d_area.width()) * rec.d_area.height();
+        if( !info )
+        {
+            if( fps > 0 )
+            {
+                // the screen as it was before this record for every frame time passed
+                // frame times are computed from the frame number so they don't drift
+                if( startMs < 0 )
+                    startMs = rec.d_ms;
+                while( rec.d_ms > startMs + frameNo * 1000.0 / fps )
+                {
+                    if( !sink.write( screen, r.width(), r.height() ) )
+                        return -1;
+                    frameNo++;
+                }
+            }else if( !each && records > 1 && rec.d_ms != last )
+            {
+                // the records of one presented frame share their time
+                if( !sink.write( screen, r.width(), r.height() ) )
+                    return -1;
+            }
+        }
+        r.apply( screen );
+        last = rec.d_ms;
+        if( each && !info && !sink.write( screen, r.width(), r.height() ) )
+            return -1;
+    }
+    if( *r.getError() )
+    {
+        qCritical() << "ERROR:" << r.getError();
+        return -1;
+    }
+    if( !info && !each && records > 0 )
+    {
+        if( !sink.write( screen, r.width(), r.height() ) )
+            return -1;
+    }
+    out << records << " records, " << ( last - first ) << " ms, " << pixels << " pixels updated, " <<
+           r.width() << "x" << r.height() << ", " << sink.d_count << " frames written" << endl;
+    return 0;
+}
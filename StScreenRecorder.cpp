@@ -0,0 +1,287 @@
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+#include "StScreenRecorder.h"
+#include "StDisplay.h"
+#include <QFile>
+#include <QtDebug>
+#include <string.h>
+using namespace St;
+
+static const char s_magic[] = "St80Rec"; // including the terminating zero
+enum { Version = 1, HeaderLen = 16, RecordHeaderLen = 17 };
+
+static inline void writeU16( quint8* data, int off, quint16 val )
+{
+    data[off] = ( val >> 8 ) & 0xff;
+    data[off+1] = val & 0xff;
+}
+
+static inline void writeU32( quint8* data, int off, quint32 val )
+{
+    writeU16( data, off, val >> 16 );
+    writeU16( data, off + 2, val & 0xffff );
+}
+
+static inline quint16 readU16( const quint8* data, int off )
+{
+    return ( quint16(data[off]) << 8 ) | data[off+1];
+}
+
+static inline quint32 readU32( const quint8* data, int off )
+{
+    return ( quint32(readU16( data, off )) << 16 ) | readU16( data, off + 2 );
+}
+
+ScreenRecorder::ScreenRecorder():d_out(0),d_width(0),d_height(0),d_compress(true)
+{
+}
+
+ScreenRecorder::~ScreenRecorder()
+{
+    close();
+}
+
+bool ScreenRecorder::open(const QString& path, quint16 width, quint16 height, bool compress)
+{
+    close();
+    QFile* f = new QFile(path);
+    if( !f->open(QIODevice::WriteOnly) )
+    {
+        qCritical() << "ERROR: cannot open screen recording for writing" << path;
+        delete f;
+        return false;
+    }
+    d_out = f;
+    d_width = width;
+    d_height = height;
+    d_compress = compress;
+
+    quint8 header[HeaderLen];
+    ::memcpy( header, s_magic, 8 );
+    writeU16( header, 8, Version );
+    writeU16( header, 10, width );
+    writeU16( header, 12, height );
+    writeU16( header, 14, 0 );
+    d_out->write( (const char*)header, HeaderLen );
+    return true;
+}
+
+void ScreenRecorder::close()
+{
+    if( d_out == 0 )
+        return;
+    d_out->close();
+    delete d_out;
+    d_out = 0;
+}
+
+void ScreenRecorder::record(const Bitmap& bm, const QRect& area, quint32 ms)
+{
+    if( d_out == 0 || bm.isNull() )
+        return;
+    const QRect r = area & QRect( 0, 0, qMin( bm.width(), d_width ), qMin( bm.height(), d_height ) );
+    if( r.isEmpty() )
+        return;
+    const int raster = ( bm.width() + 15 ) / 16;
+    const int wx = r.x() / 16;
+    const int ww = ( r.x() + r.width() - 1 ) / 16 - wx + 1;
+
+    d_buf.resize( RecordHeaderLen + ww * 2 * r.height() );
+    quint8* data = (quint8*)d_buf.data();
+    int off = RecordHeaderLen;
+    for( int y = r.y(); y < r.y() + r.height(); y++ )
+    {
+        const int base = y * raster + wx;
+        for( int x = 0; x < ww; x++, off += 2 )
+            writeU16( data, off, bm.word( base + x ) );
+    }
+
+    quint8 encoding = Raw;
+    const int rawLen = d_buf.size() - RecordHeaderLen;
+    if( d_compress )
+    {
+        d_packed.resize(0);
+        packBits( data + RecordHeaderLen, rawLen, d_packed );
+        if( d_packed.size() < rawLen )
+            encoding = RunLength;
+    }
+
+    writeU32( data, 0, ms );
+    writeU16( data, 4, wx );
+    writeU16( data, 6, r.y() );
+    writeU16( data, 8, ww );
+    writeU16( data, 10, r.height() );
+    data[12] = encoding;
+    if( encoding == RunLength )
+    {
+        writeU32( data, 13, d_packed.size() );
+        d_out->write( (const char*)data, RecordHeaderLen );
+        d_out->write( d_packed );
+    }else
+    {
+        writeU32( data, 13, rawLen );
+        d_out->write( d_buf );
+    }
+}
+
+void ScreenRecorder::packBits(const quint8* data, int len, QByteArray& out)
+{
+    // PackBits: n in 0..127 is followed by n + 1 literal bytes, n in -127..-1 by one byte
+    // repeated 1 - n times
+    int i = 0;
+    while( i < len )
+    {
+        int run = 1;
+        while( i + run < len && run < 128 && data[i + run] == data[i] )
+            run++;
+        if( run > 1 )
+        {
+            out.append( char( 1 - run ) );
+            out.append( char( data[i] ) );
+            i += run;
+            continue;
+        }
+        int lit = 1;
+        while( i + lit < len && lit < 128 &&
+               !( i + lit + 1 < len && data[i + lit] == data[i + lit + 1] ) )
+            lit++;
+        out.append( char( lit - 1 ) );
+        out.append( (const char*)data + i, lit );
+        i += lit;
+    }
+}
+
+bool ScreenRecorder::unpackBits(const quint8* data, int len, quint8* out, int outLen)
+{
+    int i = 0, o = 0;
+    while( i < len )
+    {
+        const int n = qint8( data[i++] );
+        if( n >= 0 )
+        {
+            if( i + n + 1 > len || o + n + 1 > outLen )
+                return false;
+            ::memcpy( out + o, data + i, n + 1 );
+            i += n + 1;
+            o += n + 1;
+        }else if( n != -128 )
+        {
+            if( i >= len || o + 1 - n > outLen )
+                return false;
+            ::memset( out + o, data[i++], 1 - n );
+            o += 1 - n;
+        }
+    }
+    return o == outLen;
+}
+
+ScreenLogReader::ScreenLogReader(QIODevice* in):d_in(in),d_width(0),d_height(0),d_error("")
+{
+}
+
+bool ScreenLogReader::readHeader()
+{
+    const QByteArray header = d_in->read( HeaderLen );
+    if( header.size() != HeaderLen || ::memcmp( header.constData(), s_magic, 8 ) != 0 )
+    {
+        d_error = "not a screen recording";
+        return false;
+    }
+    const quint8* data = (const quint8*)header.constData();
+    if( readU16( data, 8 ) != Version )
+    {
+        d_error = "unsupported screen recording version";
+        return false;
+    }
+    d_width = readU16( data, 10 );
+    d_height = readU16( data, 12 );
+    return true;
+}
+
+bool ScreenLogReader::readRecord(ScreenLogReader::Record& rec)
+{
+    const int raster = ( d_width + 15 ) / 16;
+    const QByteArray header = d_in->read( RecordHeaderLen );
+    if( header.isEmpty() )
+        return false; // regular end
+    if( header.size() != RecordHeaderLen )
+    {
+        d_error = "truncated record header";
+        return false;
+    }
+    const quint8* h = (const quint8*)header.constData();
+    rec.d_ms = readU32( h, 0 );
+    const int wx = readU16( h, 4 );
+    const int y0 = readU16( h, 6 );
+    const int ww = readU16( h, 8 );
+    const int rows = readU16( h, 10 );
+    const quint8 encoding = h[12];
+    const quint32 len = readU32( h, 13 );
+    if( wx + ww > raster || y0 + rows > d_height )
+    {
+        d_error = "record outside of screen";
+        return false;
+    }
+    rec.d_area = QRect( wx * 16, y0, ww * 16, rows );
+    d_words = QRect( wx, y0, ww, rows );
+
+    const int rawLen = ww * 2 * rows;
+    if( encoding == ScreenRecorder::RunLength )
+    {
+        const QByteArray payload = d_in->read( len );
+        if( payload.size() != int(len) )
+        {
+            d_error = "truncated record";
+            return false;
+        }
+        d_buf.resize( rawLen );
+        if( !ScreenRecorder::unpackBits( (const quint8*)payload.constData(), len, (quint8*)d_buf.data(), rawLen ) )
+        {
+            d_error = "invalid run length data";
+            return false;
+        }
+    }else
+    {
+        if( int(len) != rawLen )
+        {
+            d_error = "invalid record length";
+            return false;
+        }
+        d_buf = d_in->read( len );
+        if( d_buf.size() != int(len) )
+        {
+            d_error = "truncated record";
+            return false;
+        }
+    }
+    return true;
+}
+
+void ScreenLogReader::apply(QByteArray& screen) const
+{
+    const int raster = ( d_width + 15 ) / 16;
+    if( screen.size() != raster * 2 * d_height )
+        screen = QByteArray( raster * 2 * d_height, 0 );
+    quint8* out = (quint8*)screen.data();
+    const quint8* raw = (const quint8*)d_buf.constData();
+    const int lineLen = d_words.width() * 2;
+    for( int y = 0; y < d_words.height(); y++ )
+        ::memcpy( out + ( ( d_words.y() + y ) * raster + d_words.x() ) * 2, raw + y * lineLen, lineLen );
+}
@@ -0,0 +1,87 @@
+#ifndef ST_SCREEN_RECORDER_H
+#define ST_SCREEN_RECORDER_H
+
+/*
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+*/
+
+
+#include <QByteArray>
+#include <QRect>
+
+class QIODevice;
+
+namespace St
+{
+    class Bitmap;
+
+    // Append-only log of the 1 bpp screen. A record holds the whole DisplayBitmap words covering
+    // a changed rectangle, so replaying all records up to a point rebuilds the screen at that
+    // moment. See StScreenPlayer for the offline tool which turns a log into frames.
+    //
+    // | "St80Rec" 0 | u16 version | u16 width | u16 height | u16 flags, unused |
+    // record: | u32 ms | u16 word x | u16 y | u16 word width | u16 height | u8 encoding | u32 length | data |
+    // data are the big endian words of the rectangle row by row; encoding 1 is PackBits RLE
+    class ScreenRecorder
+    {
+    public:
+        enum Encoding { Raw = 0, RunLength = 1 };
+        ScreenRecorder();
+        ~ScreenRecorder();
+        bool open( const QString& path, quint16 width, quint16 height, bool compress = true );
+        void close();
+        bool isOpen() const { return d_out != 0; }
+        // the first record after open should cover the whole screen
+        void record( const Bitmap&, const QRect&, quint32 ms );
+        static void packBits( const quint8* data, int len, QByteArray& out );
+        static bool unpackBits( const quint8* data, int len, quint8* out, int outLen );
+    private:
+        QIODevice* d_out;
+        QByteArray d_buf, d_packed;
+        quint16 d_width, d_height;
+        bool d_compress;
+    };
+
+    class ScreenLogReader
+    {
+    public:
+        struct Record
+        {
+            quint32 d_ms;
+            QRect d_area; // in pixels, word aligned horizontally
+        };
+        ScreenLogReader( QIODevice* );
+        bool readHeader();
+        quint16 width() const { return d_width; }
+        quint16 height() const { return d_height; }
+        // returns false at the end of the log or on error, see getError
+        bool readRecord( Record& );
+        // applies the last record read to screen, a big endian 1 bpp buffer of height rows with
+        // ( width + 15 ) / 16 words each
+        void apply( QByteArray& screen ) const;
+        const char* getError() const { return d_error; }
+    private:
+        QIODevice* d_in;
+        QByteArray d_buf;
+        QRect d_words; // of the last record, x and width in words
+        quint16 d_width, d_height;
+        const char* d_error;
+    };
+}
+
+#endif // ST_SCREEN_RECORDER_H
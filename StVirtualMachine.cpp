@@ -23,33 +23,116 @@
 #include "StDisplay.h"
 #include <QApplication>
 #include <QFileDialog>
+#include <QFileInfo>
+#include <QDir>
 #include <QMessageBox>
+#include <QSaveFile>
 #include <QtDebug>
 using namespace St;
 
-VirtualMachine::VirtualMachine(QObject* parent) : QObject(parent)
+VirtualMachine::VirtualMachine(QObject* parent) : QObject(parent),d_useSnapshots(true)
 {
     d_om = new ObjectMemory2(this);
     d_ip = new Interpreter(this);
 }
 
+static QString savedImagePath( QString path )
+{
+    // never overwrite the original image; saved images are written next to it and then overwritten
+    if( path.endsWith(".snap") )
+        path.chop(5);
+    if( path.endsWith(".saved.image") )
+        return path;
+    const QFileInfo info(path);
+    return info.absoluteDir().absoluteFilePath( info.completeBaseName() + ".saved.image" );
+}
+
 void VirtualMachine::run(const QString& path)
+{
+    if( !load(path) )
+        return;
+    const QString saved = savedImagePath(path);
+    d_ip->setSnapshotPath( saved, d_useSnapshots ? saved + ".snap" : QString() );
+
+    d_ip->setOm(d_om);
+    d_ip->interpret();
+    dumpStats();
+}
+
+bool VirtualMachine::load(const QString& path)
 {
     QFile in(path);
     if( !in.open(QIODevice::ReadOnly) )
     {
         QMessageBox::critical(Display::inst(),tr("Loading Smalltalk-80 Image"), tr("Cannot open file %1").arg(path) );
-        return;
+        return false;
+    }
+    if( ObjectMemory2::isSnapshot(&in) )
+    {
+        in.close();
+        if( d_om->mapSnapshot(path) )
+            return true;
+        QMessageBox::critical(Display::inst(),tr("Loading Smalltalk-80 Image"),
+                              tr("Snapshot was written by an incompatible VM build.") );
+        return false;
+    }
+
+    // an up-to-date native snapshot next to the interchange image saves parsing and copying each object
+    const QString snap = path + ".snap";
+    const QFileInfo snapInfo(snap);
+    if( d_useSnapshots && snapInfo.exists() && snapInfo.lastModified() >= QFileInfo(path).lastModified() )
+    {
+        if( d_om->mapSnapshot(snap) )
+            return true;
+        qWarning() << "WARNING: ignoring incompatible snapshot" << snap;
     }
+
     const bool res = d_om->readFrom(&in);
     if( !res )
     {
         QMessageBox::critical(Display::inst(),tr("Loading Smalltalk-80 Image"), tr("Incompatible format.") );
-        return;
+        return false;
+    }
+    if( d_useSnapshots )
+    {
+        // an interrupted write must not leave a truncated snapshot which looks newer than the image
+        QSaveFile out(snap);
+        if( !out.open(QIODevice::WriteOnly) || !d_om->writeSnapshot(&out) || !out.commit() )
+        {
+            out.cancelWriting();
+            qDebug() << "INFO: cannot write snapshot" << snap;
+        }
     }
+    return true;
+}
 
-    d_ip->setOm(d_om);
-    d_ip->interpret();
+void VirtualMachine::setAllocationSampling(quint32 interval, bool bytes)
+{
+#ifdef ST_MEMORY_STATS
+    d_om->setAllocationSampling( interval, bytes, d_ip );
+#else
+    Q_UNUSED(interval);
+    Q_UNUSED(bytes);
+    qWarning() << "WARNING: allocation sampling not available, compile with ST_MEMORY_STATS";
+#endif
+}
+
+void VirtualMachine::dumpStats()
+{
+    if( d_statsFile.isEmpty() )
+        return;
+#ifdef ST_MEMORY_STATS
+    QFile out(d_statsFile);
+    if( !out.open(QIODevice::WriteOnly) )
+    {
+        qCritical() << "ERROR: cannot write memory statistics to" << d_statsFile;
+        return;
+    }
+    out.write( d_om->statsToJson() );
+    qDebug() << "INFO: memory statistics written to" << d_statsFile;
+#else
+    qWarning() << "WARNING: memory statistics not available, compile with ST_MEMORY_STATS";
+#endif
 }
 
 
@@ -64,23 +147,52 @@ int main(int argc, char *argv[])
 
     VirtualMachine w;
 
+    QString imagePath;
+    bool stats = false;
     for( int i = 1; i < a.arguments().size(); i++ )
     {
         if( a.arguments()[i] == "-log" )
-        {
             Display::inst()->setLog(true);
-            break;
+        else if( a.arguments()[i] == "-stats" )
+            stats = true;
+        else if( a.arguments()[i] == "-nosnap" )
+            w.setUseSnapshots(false);
+        else if( ( a.arguments()[i] == "-allocsites" || a.arguments()[i] == "-allocbytes" )
+                 && i + 1 < a.arguments().size() )
+        {
+            // sample every n-th allocation or allocated byte; reported in the -stats file
+            w.setAllocationSampling( a.arguments()[i+1].toUInt(), a.arguments()[i] == "-allocbytes" );
+            stats = true;
+            i++;
         }
+        else if( a.arguments()[i] == "-record" && i + 1 < a.arguments().size() )
+        {
+            // log of the changed screen areas, see StScreenPlayer
+            Display::inst()->startRecording( a.arguments()[i+1] );
+            i++;
+        }
+        else if( a.arguments()[i] == "-fps" && i + 1 < a.arguments().size() )
+        {
+            Display::inst()->setFrameRate( a.arguments()[i+1].toInt() );
+            i++;
+        }
+        else if( !a.arguments()[i].startsWith('-') && imagePath.isEmpty() )
+            imagePath = a.arguments()[i];
     }
 
-    if( a.arguments().size() > 1 )
-        w.run( a.arguments()[1] );
-    else
+    if( !imagePath.isEmpty() )
+    {
+        if( stats )
+            w.setStatsFile( imagePath + ".stats.json" );
+        w.run( imagePath );
+    }else
     {
         const QString path = QFileDialog::getOpenFileName(Display::inst(),VirtualMachine::tr("Open Smalltalk-80 Image File"),
                                                           QString(), "VirtualImage *.image *.im" );
         if( path.isEmpty() )
             return 0;
+        if( stats )
+            w.setStatsFile( path + ".stats.json" );
         w.run(path);
     }
     return 0; // a.exec();
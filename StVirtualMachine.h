@@ -32,9 +32,17 @@ namespace St
     public:
         explicit VirtualMachine(QObject *parent = 0);
         void run( const QString& path );
+        void setStatsFile( const QString& path ) { d_statsFile = path; }
+        void setAllocationSampling( quint32 interval, bool bytes );
+        void setUseSnapshots( bool on ) { d_useSnapshots = on; }
+    protected:
+        bool load( const QString& path );
+        void dumpStats();
     private:
         ObjectMemory2* d_om;
         Interpreter* d_ip;
+        QString d_statsFile;
+        bool d_useSnapshots;
     };
 }
 
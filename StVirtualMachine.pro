@@ -27,20 +27,27 @@ TEMPLATE = app
 INCLUDEPATH += ..
 
 DEFINES += ST_IMG_VIEWER_EMBEDDED ST_OBJECT_MEMORY=ObjectMemory2
+#DEFINES += ST_OOP32 # 32 bit OOPs and 31 bit SmallIntegers, see StObjectMemory2.h
+#DEFINES += ST_MEMORY_STATS # allocation and GC telemetry, see ObjectMemory2::getStats
+#DEFINES += ST_INSTANCE_INDEX # per class instance bitmaps for someInstance/nextInstance, see ObjectMemory2::getNextInstance
 
 
 SOURCES +=\
     StInterpreter.cpp \
     StObjectMemory2.cpp \
+    StImageWriter.cpp \
     StVirtualMachine.cpp \
     StDisplay.cpp \
+    StScreenRecorder.cpp \
     StImageViewer.cpp
 
 HEADERS  += \
     StInterpreter.h \
     StObjectMemory2.h \
+    StImageWriter.h \
     StVirtualMachine.h \
     StDisplay.h \
+    StScreenRecorder.h \
     StImageViewer.h
 
 
@@ -0,0 +1,270 @@
+--[[
+* Copyright 2020 Rochus Keller <mailto:me@rochus-keller.ch>
+*
+* This file is part of the Smalltalk parser/compiler library.
+*
+* The following is the license that applies to this copy of the
+* library. For a license to use the library under conditions
+* other than those described here, please email to me@rochus-keller.ch.
+*
+* GNU General Public License Usage
+* This file may be used under the terms of the GNU General Public
+* License (GPL) versions 2.0 or 3.0 as published by the Free Software
+* Foundation and appearing in the file LICENSE.GPL included in
+* the packaging of this file. Please review the following information
+* to ensure GNU General Public Licensing requirements will be met:
+* http://www.fsf.org/licensing/licenses/info/GPLv2.html and
+* http://www.gnu.org/copyleft/gpl.html.
+]]--
+
+--[[
+	Translates the bytecode of a CompiledMethod into the source of a Lua function, which is then
+	compiled by loadstring (and later traced by the JIT like any other Lua code).
+	
+	Only the bytecodes which neither send nor return are translated: the pushes and stores, pop, 
+	dup, thisContext, the jumps, the SmallInteger arithmetic and comparison special selectors and ==. 
+	Every other bytecode is an exit; the function then returns the stack pointer and the instruction 
+	pointer of the exit bytecode, which the interpreter executes as usual. Whenever the interpreter 
+	arrives at one of the entry points of a translated method (the method start, the bytecode after an 
+	exit, a backward jump target, or a block start) it calls the function again.
+	
+	The generated function has the signature fn(context, homeContext, receiver, method, sp, ip) -> sp, ip
+	and works directly on the context slots like the interpreter does; sp and ip have the same meaning
+	as the interpreter registers stackPointer and instructionPointer.
+]]--
+
+local string = require "string"
+local table = require "table"
+local math = require "math"
+local bit = require "bit"
+
+local module = {}
+
+module.maxBytes = 1024 -- larger methods are left to the interpreter
+module.budget = 256 -- backward jumps before control is given back for process switches and events
+
+local function lengthOf(b)
+	if b == 128 or b == 129 or b == 130 or b == 131 or b == 133 or ( b >= 160 and b <= 175 ) then
+		return 2
+	elseif b == 132 or b == 134 then
+		return 3
+	else
+		return 1
+	end
+end
+
+local function decode(bytecode)
+	local len = bytecode.count
+	local code = {}
+	local pc = 0
+	while pc < len do
+		local b = bytecode.data[pc]
+		local n = lengthOf(b)
+		if pc + n > len then
+			return nil
+		end
+		local ins = { pc = pc, op = b, len = n }
+		if n > 1 then
+			ins.arg = bytecode.data[pc+1]
+		end
+		code[#code+1] = ins
+		pc = pc + n
+	end
+	return code, len
+end
+
+local function jumpTarget(ins)
+	local b = ins.op
+	if b >= 144 and b <= 159 then
+		return ins.pc + 1 + bit.band( b, 7 ) + 1
+	elseif b >= 160 and b <= 167 then
+		return ins.pc + 2 + ( b - 164 ) * 256 + ins.arg
+	elseif b >= 168 and b <= 175 then
+		return ins.pc + 2 + bit.band( b, 3 ) * 256 + ins.arg
+	end
+end
+
+local function isTranslated(ins)
+	local b = ins.op
+	if b <= 119 or b == 128 or ( b >= 135 and b <= 137 ) or ( b >= 144 and b <= 184 ) or 
+		b == 190 or b == 191 or b == 198 then
+		return true
+	elseif b == 129 or b == 130 then
+		return bit.rshift( ins.arg, 6 ) ~= 2 -- storing into a literal constant is an error left to the interpreter
+	else
+		return false
+	end
+end
+
+local function pushCode(val)
+	return "sp = sp + 1 ctx[sp] = " .. val
+end
+
+local function variableCode(descriptor)
+	local t = bit.rshift( descriptor, 6 )
+	local i = bit.band( descriptor, 63 )
+	if t == 0 then
+		return "rcv[" .. i .. "]"
+	elseif t == 1 then
+		return "home[" .. ( i + 6 ) .. "]" -- TempFrameStart
+	elseif t == 2 then
+		return "m[" .. i .. "]"
+	else
+		return "m[" .. i .. "][1]" -- ValueIndex
+	end
+end
+
+local constants = { [113] = "true", [114] = "false", [115] = "nil", [116] = "-1", [117] = "0", [118] = "1", [119] = "2" }
+local compares = { [178] = "<", [179] = ">", [180] = "<=", [181] = ">=", [182] = "==", [183] = "~=" }
+local arithmetics = { [176] = "a + c", [177] = "a - c", [184] = "a * c" }
+local bitwise = { [190] = "band( a, c )", [191] = "bor( a, c )" }
+
+-- the SmallInteger range, see St_isIntegerValue
+local checkNumbers = "a = ctx[sp-1] c = ctx[sp] if type(a) ~= \"number\" or type(c) ~= \"number\" then return sp, %d end"
+
+local function emitInstruction( out, ins, base )
+	local b = ins.op
+	local ip = base + ins.pc
+	out[#out+1] = "::L" .. ins.pc .. "::"
+	if not isTranslated(ins) then
+		out[#out+1] = "do return sp, " .. ip .. " end"
+	elseif b <= 15 then
+		out[#out+1] = pushCode( "rcv[" .. b .. "]" )
+	elseif b <= 31 then
+		out[#out+1] = pushCode( "home[" .. ( b - 16 + 6 ) .. "]" )
+	elseif b <= 63 then
+		out[#out+1] = pushCode( "m[" .. ( b - 32 ) .. "]" )
+	elseif b <= 95 then
+		out[#out+1] = pushCode( "m[" .. ( b - 64 ) .. "][1]" )
+	elseif b <= 103 then
+		out[#out+1] = "rcv[" .. ( b - 96 ) .. "] = ctx[sp] sp = sp - 1"
+	elseif b <= 111 then
+		out[#out+1] = "home[" .. ( b - 104 + 6 ) .. "] = ctx[sp] sp = sp - 1"
+	elseif b == 112 then
+		out[#out+1] = pushCode( "rcv" )
+	elseif b <= 119 then
+		out[#out+1] = pushCode( constants[b] )
+	elseif b == 128 then
+		out[#out+1] = pushCode( variableCode( ins.arg ) )
+	elseif b == 129 then
+		out[#out+1] = variableCode( ins.arg ) .. " = ctx[sp]"
+	elseif b == 130 then
+		out[#out+1] = variableCode( ins.arg ) .. " = ctx[sp] sp = sp - 1"
+	elseif b == 135 then
+		out[#out+1] = "sp = sp - 1"
+	elseif b == 136 then
+		out[#out+1] = "sp = sp + 1 ctx[sp] = ctx[sp-1]"
+	elseif b == 137 then
+		out[#out+1] = pushCode( "ctx" )
+	elseif ( b >= 144 and b <= 151 ) or ( b >= 160 and b <= 167 ) then
+		local target = jumpTarget(ins)
+		if target <= ins.pc then
+			out[#out+1] = "budget = budget - 1 if budget == 0 then return sp, " .. ( base + target ) .. " end"
+		end
+		out[#out+1] = "goto L" .. target
+	elseif b <= 175 then
+		-- a non-boolean is left to the interpreter, which sends mustBeBoolean
+		local jumpIf = "false"
+		if b >= 168 and b <= 171 then
+			jumpIf = "true"
+		end
+		out[#out+1] = "a = ctx[sp] if a == " .. jumpIf .. " then sp = sp - 1 goto L" .. jumpTarget(ins) ..
+			" elseif a ~= true and a ~= false then return sp, " .. ip .. " end sp = sp - 1"
+	elseif compares[b] then
+		out[#out+1] = string.format( checkNumbers, ip ) .. " sp = sp - 1 ctx[sp] = a " .. compares[b] .. " c"
+	elseif arithmetics[b] then
+		out[#out+1] = string.format( checkNumbers, ip ) .. " r = " .. arithmetics[b] ..
+			" if r < -16384 or r > 16383 then return sp, " .. ip .. " end sp = sp - 1 ctx[sp] = r"
+	elseif bitwise[b] then
+		out[#out+1] = string.format( checkNumbers, ip ) .. " sp = sp - 1 ctx[sp] = " .. bitwise[b]
+	elseif b == 198 then
+		out[#out+1] = "c = ctx[sp] sp = sp - 1 ctx[sp] = ctx[sp] == c"
+	end
+end
+
+-- binary search over the sorted entry points; an ip which is no entry returns unchanged
+local function emitDispatch( out, entries, lo, hi, base )
+	if lo == hi then
+		out[#out+1] = "if ip == " .. ( base + entries[lo] ) .. " then goto L" .. entries[lo] .. " end"
+		return
+	end
+	local mid = math.floor( ( lo + hi ) / 2 )
+	out[#out+1] = "if ip <= " .. ( base + entries[mid] ) .. " then"
+	emitDispatch( out, entries, lo, mid, base )
+	out[#out+1] = "else"
+	emitDispatch( out, entries, mid + 1, hi, base )
+	out[#out+1] = "end"
+end
+
+-- returns the function and the set of instruction pointers at which it can be entered, or nil if
+-- the method is not suited for translation
+function module.translate( method )
+	local bytecode = method.bytecode
+	if bytecode == nil or bytecode.count > module.maxBytes then
+		return nil
+	end
+	local code, len = decode( bytecode )
+	if code == nil or #code == 0 then
+		return nil
+	end
+	local starts = {}
+	for i = 1, #code do
+		starts[code[i].pc] = true
+	end
+	starts[len] = true
+	
+	local isEntry = { [0] = true }
+	for i = 1, #code do
+		local ins = code[i]
+		local next = ins.pc + ins.len
+		local target = jumpTarget(ins)
+		if target then
+			if not starts[target] then
+				return nil
+			end
+			if target <= ins.pc then
+				isEntry[target] = true
+			end
+			if ( ins.op >= 144 and ins.op <= 151 ) or ( ins.op >= 160 and ins.op <= 167 ) then
+				isEntry[next] = true -- code after an unconditional jump is a block start or a jump target
+			end
+		elseif not isTranslated(ins) then
+			isEntry[next] = true
+		end
+	end
+	isEntry[len] = nil
+	
+	local entries = {}
+	for pc in pairs(isEntry) do
+		entries[#entries+1] = pc
+	end
+	table.sort(entries)
+	
+	local base = ( method.count + 1 ) * 2 -- instructionPointer at offset 0, see fetchByte
+	local out = {}
+	out[#out+1] = "local type, band, bor = ..."
+	out[#out+1] = "return function( ctx, home, rcv, m, sp, ip )"
+	out[#out+1] = "local a, c, r"
+	out[#out+1] = "local budget = " .. module.budget
+	emitDispatch( out, entries, 1, #entries, base )
+	out[#out+1] = "do return sp, ip end"
+	for i = 1, #code do
+		emitInstruction( out, code[i], base )
+	end
+	out[#out+1] = "::L" .. len .. "::"
+	out[#out+1] = "do return sp, " .. ( base + len ) .. " end"
+	out[#out+1] = "end"
+	
+	local chunk, err = loadstring( table.concat( out, "\n" ), "=method " .. tostring(method.oop) )
+	if chunk == nil then
+		print( "ERROR: cannot translate method", method.oop, err )
+		return nil
+	end
+	local ips = {}
+	for i = 1, #entries do
+		ips[ base + entries[i] ] = true
+	end
+	return chunk( type, bit.band, bit.bor ), ips
+end
+
+return module